@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <inttypes.h>
+#include "omar.h"
+
+/* Size classes, by power of two */
+#define AN_NCLASS 65
+
+/* Slots of the duplicate table, fixed to bound memory */
+#define AN_DUPSLOTS (1 << 16)
+
+/*
+ * Bytes of each file hashed to find duplicate candidates,
+ * files only alike past these are counted as duplicates.
+ */
+#define AN_PROBESZ 4096
+
+/* Number of directories reported */
+#define AN_TOPDIRS 10
+
+/*
+ * Files sharing a size and the hash of their
+ * first AN_PROBESZ bytes.
+ */
+struct an_dup {
+    uint64_t size;
+    uint64_t probe;
+    uint64_t count;
+};
+
+/*
+ * Bytes of the files below a directory
+ */
+struct an_dir {
+    char name[OMAR_PATHMAX];
+    uint64_t bytes;
+};
+
+/*
+ * @files: Number of files
+ * @chunked: Number of chunked files
+ * @dirs: Number of directories
+ * @bytes: Logical size of all files
+ * @stored: Bytes used by all live entries
+ * @pad: Block padding within live entries
+ * @nclass: Files per size class
+ * @bclass: Bytes per size class
+ * @dups: Duplicate table
+ * @ndups: Slots used in @dups
+ * @dirmap: Bytes below each directory, by path
+ * @top: Largest directories, largest first
+ * @ntop: Number of directories in @top
+ */
+struct analysis {
+    uint64_t files;
+    uint64_t chunked;
+    uint64_t dirs;
+    uint64_t bytes;
+    uint64_t stored;
+    uint64_t pad;
+    uint64_t nclass[AN_NCLASS];
+    uint64_t bclass[AN_NCLASS];
+    struct an_dup *dups;
+    size_t ndups;
+    struct omar_map dirmap;
+    struct an_dir top[AN_TOPDIRS];
+    size_t ntop;
+};
+
+static inline void
+analyze_help(void)
+{
+    printf("Usage: omar analyze [archive]\n");
+}
+
+/*
+ * Size class of a file, 0 for empty files
+ * and n for sizes in [2^(n-1), 2^n).
+ */
+static inline size_t
+size_class(uint64_t size)
+{
+    size_t n = 0;
+
+    while (size > 0) {
+        size >>= 1;
+        ++n;
+    }
+
+    return n;
+}
+
+/*
+ * Count a file in the duplicate table. Once the table
+ * is mostly full new contents are no longer tracked.
+ */
+static void
+dup_count(struct analysis *an, uint64_t size, uint64_t probe)
+{
+    struct an_dup *dup;
+    size_t i;
+
+    i = (size * 0x9E3779B97F4A7C15ULL ^ probe) & (AN_DUPSLOTS - 1);
+    for (;;) {
+        dup = &an->dups[i];
+        if (dup->count == 0) {
+            break;
+        }
+        if (dup->size == size && dup->probe == probe) {
+            ++dup->count;
+            return;
+        }
+        i = (i + 1) & (AN_DUPSLOTS - 1);
+    }
+
+    if (an->ndups >= AN_DUPSLOTS / 4 * 3) {
+        return;
+    }
+
+    dup->size = size;
+    dup->probe = probe;
+    dup->count = 1;
+    ++an->ndups;
+}
+
+/*
+ * Offer a directory to the list of the largest ones
+ */
+static void
+top_offer(struct analysis *an, const struct an_dir *dir)
+{
+    size_t i;
+
+    for (i = an->ntop; i > 0; --i) {
+        if (an->top[i - 1].bytes >= dir->bytes) {
+            break;
+        }
+    }
+    if (i == AN_TOPDIRS) {
+        return;
+    }
+
+    if (an->ntop < AN_TOPDIRS) {
+        ++an->ntop;
+    }
+    memmove(&an->top[i + 1], &an->top[i],
+            (an->ntop - i - 1) * sizeof(an->top[0]));
+    an->top[i] = *dir;
+}
+
+/*
+ * Bytes counter of directory @name, created
+ * on first use. NULL if we ran out of memory.
+ */
+static uint64_t *
+dir_get(struct analysis *an, const char *name)
+{
+    void **slot;
+
+    if ((slot = map_put(&an->dirmap, name)) == NULL) {
+        return NULL;
+    }
+    if (*slot == NULL) {
+        *slot = calloc(1, sizeof(uint64_t));
+    }
+    return *slot;
+}
+
+/*
+ * Count @size bytes towards every directory above @name.
+ * Each one is looked up by path, so entries appended out of
+ * walk order (update, merge) count under the right one.
+ */
+static int
+dir_charge(struct analysis *an, const char *name, uint64_t size)
+{
+    char path[OMAR_PATHMAX];
+    uint64_t *bytes;
+    char *p;
+
+    snprintf(path, sizeof(path), "%s", name);
+    while ((p = strrchr(path, '/')) != NULL) {
+        *p = '\0';
+        if ((bytes = dir_get(an, path)) == NULL) {
+            return -ENOMEM;
+        }
+        *bytes += size;
+    }
+    return 0;
+}
+
+/*
+ * Account for one entry
+ */
+static int
+analyze_ent(struct analysis *an, struct omar_ar *ar, struct omar_ent *ent)
+{
+    char probe[AN_PROBESZ];
+    uint64_t size, len;
+    size_t n;
+    int error;
+
+    an->stored += ent->span;
+
+    if (ent->hdr.type == OMAR_DIR) {
+        ++an->dirs;
+        an->pad += ent->span - sizeof(ent->hdr) - omar_namesz(&ent->hdr);
+        return (dir_get(an, ent->name) == NULL) ? -ENOMEM : 0;
+    }
+
+    len = sizeof(ent->hdr) + omar_namesz(&ent->hdr) + ent->hdr.len;
+    an->pad += ent->span - len;
+
+    if ((error = ar_size(ar, &ent->hdr, ent->dataoff, &size)) != 0) {
+        return error;
+    }
+
+    ++an->files;
+    an->bytes += size;
+    if (ent->hdr.type == OMAR_CHUNKED) {
+        ++an->chunked;
+    }
+
+    n = size_class(size);
+    ++an->nclass[n];
+    an->bclass[n] += size;
+
+    if ((error = dir_charge(an, ent->name, size)) != 0) {
+        return error;
+    }
+
+    if (size == 0) {
+        return 0;
+    }
+
+    n = (size < sizeof(probe)) ? size : sizeof(probe);
+    error = ar_pread(ar, &ent->hdr, ent->dataoff, probe, n, 0);
+    if (error != 0) {
+        return error;
+    }
+
+    dup_count(an, size, xxh64(probe, n, 0));
+    return 0;
+}
+
+/*
+ * Print the report
+ *
+ * @an: Analysis
+ * @used: Bytes between the first header and the EOF record
+ */
+static void
+analyze_dump(struct analysis *an, uint64_t used)
+{
+    struct an_dup *dup;
+    uint64_t dupfiles = 0, dupbytes = 0, chunkable = 0;
+    size_t i;
+
+    printf("entries: %" PRIu64 " files (%" PRIu64 " chunked), "
+           "%" PRIu64 " directories\n", an->files, an->chunked, an->dirs);
+    printf("data: %" PRIu64 " bytes, stored in %" PRIu64 " bytes\n",
+           an->bytes, an->stored);
+    printf("padding: %" PRIu64 " bytes (%.1f%%), %.1f bytes per entry "
+           "for %d byte blocks\n", an->pad,
+           (an->stored == 0) ? 0.0 : 100.0 * an->pad / an->stored,
+           (an->files + an->dirs == 0) ? 0.0 :
+           (double)an->pad / (an->files + an->dirs), BLOCK_SIZE);
+
+    printf("\nsize distribution:\n");
+    for (i = 0; i < AN_NCLASS; ++i) {
+        if (an->nclass[i] == 0) {
+            continue;
+        }
+        if (i == 0) {
+            printf("  %20s", "empty");
+        } else {
+            printf("  >= %17" PRIu64, (uint64_t)1 << (i - 1));
+        }
+        printf(": %" PRIu64 " files, %" PRIu64 " bytes\n",
+               an->nclass[i], an->bclass[i]);
+    }
+
+    printf("\nlargest directories:\n");
+    for (i = 0; i < an->ntop; ++i) {
+        printf("  %" PRIu64 " %s\n", an->top[i].bytes, an->top[i].name);
+    }
+
+    for (i = 0; i < AN_DUPSLOTS; ++i) {
+        dup = &an->dups[i];
+        if (dup->count < 2) {
+            continue;
+        }
+        dupfiles += dup->count - 1;
+        dupbytes += (dup->count - 1) * dup->size;
+        if (dup->size >= CDC_THRESHOLD) {
+            chunkable += (dup->count - 1) * dup->size;
+        }
+    }
+
+    printf("\nduplicate candidates: %" PRIu64 " files, %" PRIu64 " bytes%s\n",
+           dupfiles, dupbytes,
+           (an->ndups >= AN_DUPSLOTS / 4 * 3) ? " (table full, lower bound)" : "");
+
+    printf("\nprojected savings:\n");
+    printf("  omar merge (drop deleted entries): %" PRIu64 " bytes\n",
+           used - an->stored);
+    printf("  --chunk (duplicate candidates alone): %" PRIu64 " bytes\n",
+           chunkable);
+}
+
+int
+analyze_main(int argc, char **argv)
+{
+    struct analysis *an;
+    struct omar_ent ent;
+    struct an_dir dir;
+    struct omar_ar ar;
+    uint64_t *bytes;
+    size_t i;
+    int optc, error;
+
+    while ((optc = getopt(argc, argv, "h")) != -1) {
+        switch (optc) {
+        case 'h':
+            analyze_help();
+            return 0;
+        default:
+            analyze_help();
+            return -1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        analyze_help();
+        return -1;
+    }
+
+    an = calloc(1, sizeof(*an));
+    if (an == NULL || (an->dups = calloc(AN_DUPSLOTS, sizeof(*an->dups))) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        free(an);
+        return -ENOMEM;
+    }
+
+    if ((error = ar_open(&ar, argv[optind])) != 0) {
+        free(an->dups);
+        free(an);
+        return error;
+    }
+
+    while ((error = ar_next(&ar, &ent)) > 0) {
+        if ((error = analyze_ent(an, &ar, &ent)) != 0) {
+            break;
+        }
+    }
+
+    if (error == 0) {
+        for (i = 0; i < an->dirmap.cap; ++i) {
+            if ((bytes = an->dirmap.tab[i].val) == NULL) {
+                continue;
+            }
+            snprintf(dir.name, sizeof(dir.name), "%s", an->dirmap.tab[i].key);
+            dir.bytes = *bytes;
+            top_offer(an, &dir);
+        }
+        analyze_dump(an, ent.off - ar.base);
+    } else {
+        fprintf(stderr, "omar: analyze failed: %s\n", strerror(-error));
+    }
+
+    ar_close(&ar);
+    map_free(&an->dirmap, true);
+    free(an->dups);
+    free(an);
+    return error;
+}
@@ -0,0 +1,938 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include "omar.h"
+
+#define AR_WINSZ    (1 << 16)
+#define OUT_BUFSZ   (1 << 16)
+#define COPY_BUFSZ  (1 << 20)
+
+/* Write-behind step of outputs that drop their pages */
+#define BEHIND_STEP (8 << 20)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static const char zeroblk[BLOCK_SIZE];
+
+/*
+ * Write out an entire buffer, retrying on short writes
+ */
+int
+write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = write(fd, p, len)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Write out an entire buffer at @off
+ */
+int
+pwrite_all(int fd, const void *buf, size_t len, off_t off)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = pwrite(fd, p, len, off)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        p += n;
+        off += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Read an entire buffer from a stream, a short
+ * read means the input is truncated.
+ */
+int
+read_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = read(fd, p, len)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (n == 0) {
+            return -EIO;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Read an entire range, a short read means the
+ * archive is truncated.
+ */
+int
+pread_all(int fd, void *buf, size_t len, off_t off)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        if ((n = pread(fd, p, len, off)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (n == 0) {
+            return -EIO;
+        }
+        p += n;
+        off += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Read @len bytes at archive offset @off, going through
+ * the read window where possible.
+ */
+int
+ar_read(struct omar_ar *ar, off_t off, void *buf, size_t len)
+{
+    ssize_t n;
+
+    if (len > AR_WINSZ) {
+        return pread_all(ar->fd, buf, len, off);
+    }
+
+    if (off < ar->winoff || off + len > ar->winoff + ar->winlen) {
+        if ((n = pread(ar->fd, ar->win, AR_WINSZ, off)) < 0) {
+            return -errno;
+        }
+        ar->winoff = off;
+        ar->winlen = n;
+        if ((size_t)n < len) {
+            return -EIO;
+        }
+    }
+
+    memcpy(buf, ar->win + (off - ar->winoff), len);
+    return 0;
+}
+
+/*
+ * Open an archive for reading. An MBR pushed with
+ * [-m] is skipped over.
+ */
+int
+ar_open(struct omar_ar *ar, const char *path)
+{
+    struct omar_hdr hdr;
+    struct stat sb;
+    off_t base;
+
+    memset(ar, 0, sizeof(*ar));
+    if ((ar->fd = open(path, O_RDONLY)) < 0) {
+        perror(path);
+        return -errno;
+    }
+
+    if (fstat(ar->fd, &sb) != 0) {
+        perror("fstat");
+        close(ar->fd);
+        return -errno;
+    }
+
+    ar->size = sb.st_size;
+    ar->win = malloc(AR_WINSZ);
+    if (ar->win == NULL) {
+        fprintf(stderr, "out of memory\n");
+        close(ar->fd);
+        return -ENOMEM;
+    }
+
+    /* A partial archive (--shard) may be empty */
+    if (ar->size == 0) {
+        return 0;
+    }
+
+    for (base = 0; base <= BLOCK_SIZE; base += BLOCK_SIZE) {
+        if (ar_read(ar, base, &hdr, sizeof(hdr)) != 0) {
+            break;
+        }
+        if (memcmp(hdr.magic, OMAR_MAGIC, sizeof(hdr.magic)) == 0 ||
+            memcmp(hdr.magic, OMAR_EOF, sizeof(hdr.magic)) == 0) {
+            ar->base = base;
+            ar->cur = base;
+            ar->rel = hdr.rev == OMAR_REV_REL;
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "omar: %s: not an OMAR archive\n", path);
+    ar_close(ar);
+    return -EINVAL;
+}
+
+/*
+ * Find the path of the directory at block @blk among
+ * those seen so far, NULL if it was not seen.
+ */
+static const char *
+ar_dirfind(struct omar_ar *ar, uint32_t blk)
+{
+    size_t lo = 0, hi = ar->ndirs, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (ar->dirs[mid].blk == blk) {
+            return ar->dirs[mid].name;
+        }
+        if (ar->dirs[mid].blk > blk) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Remember the path of the directory at block @blk,
+ * sequential reads add them in order.
+ */
+static int
+ar_dirput(struct omar_ar *ar, uint32_t blk, const char *name)
+{
+    struct omar_reldir *p;
+    size_t i;
+
+    if (ar_dirfind(ar, blk) != NULL) {
+        return 0;
+    }
+    if (ar->ndirs == ar->dircap) {
+        ar->dircap = (ar->dircap == 0) ? 64 : ar->dircap * 2;
+        if ((p = realloc(ar->dirs, ar->dircap * sizeof(*p))) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return -ENOMEM;
+        }
+        ar->dirs = p;
+    }
+
+    for (i = ar->ndirs; i > 0 && ar->dirs[i - 1].blk > blk; --i);
+    memmove(&ar->dirs[i + 1], &ar->dirs[i], (ar->ndirs - i) * sizeof(*p));
+    if ((ar->dirs[i].name = strdup(name)) == NULL) {
+        memmove(&ar->dirs[i], &ar->dirs[i + 1], (ar->ndirs - i) * sizeof(*p));
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+
+    ar->dirs[i].blk = blk;
+    ++ar->ndirs;
+    return 0;
+}
+
+/*
+ * Build the full path of the parent relative entry at
+ * @off into @buf. Basenames are put in from the right
+ * while walking up the parents, until one whose path
+ * is already known.
+ */
+static int
+ar_relname(struct omar_ar *ar, off_t off, const struct omar_hdr *hdr,
+           char *buf, size_t size)
+{
+    struct omar_relname rel;
+    struct omar_hdr dir = *hdr;
+    const char *known = NULL;
+    uint64_t blk;
+    char *p;
+    int error;
+
+    p = buf + size - 1;
+    *p = '\0';
+    for (;;) {
+        blk = (off - ar->base) / BLOCK_SIZE;
+        if ((error = ar_read(ar, off + sizeof(dir), &rel, sizeof(rel))) != 0) {
+            return error;
+        }
+        if ((size_t)(p - buf) < dir.namelen + 1u) {
+            return -ENAMETOOLONG;
+        }
+        p -= dir.namelen;
+        error = ar_read(ar, off + sizeof(dir) + sizeof(rel), p, dir.namelen);
+        if (error != 0) {
+            return error;
+        }
+        if (rel.parent == OMAR_REL_TOP) {
+            break;
+        }
+
+        *--p = '/';
+        if (rel.parent >= blk) {
+            return -EINVAL;
+        }
+        if ((known = ar_dirfind(ar, rel.parent)) != NULL) {
+            break;
+        }
+
+        off = ar->base + (off_t)rel.parent * BLOCK_SIZE;
+        if ((error = ar_read(ar, off, &dir, sizeof(dir))) != 0) {
+            return error;
+        }
+        if (memcmp(dir.magic, OMAR_MAGIC, sizeof(dir.magic)) != 0 ||
+            dir.type != OMAR_DIR || dir.rev != OMAR_REV_REL) {
+            return -EINVAL;
+        }
+    }
+
+    if (known != NULL && strlen(known) > (size_t)(p - buf)) {
+        return -ENAMETOOLONG;
+    }
+    if (known != NULL) {
+        p -= strlen(known);
+        memcpy(p, known, strlen(known));
+    }
+
+    memmove(buf, p, strlen(p) + 1);
+    return 0;
+}
+
+/*
+ * Fetch the next entry of an archive, tombstoned
+ * entries are skipped over.
+ *
+ * Returns 1 if @ent was filled in, 0 once the EOF
+ * record is reached (@ent->off is then the offset of
+ * the EOF record) and a negative value on error.
+ * Partial archives (--shard) end without an EOF
+ * record, at the end of the file.
+ */
+int
+ar_next(struct omar_ar *ar, struct omar_ent *ent)
+{
+    struct omar_hdr *hdr = &ent->hdr;
+    int error;
+
+again:
+    ent->off = ar->cur;
+    if (ar->cur == ar->size) {
+        return 0;
+    }
+    if ((error = ar_read(ar, ar->cur, hdr, sizeof(*hdr))) != 0) {
+        fprintf(stderr, "omar: truncated archive\n");
+        return error;
+    }
+
+    if (memcmp(hdr->magic, OMAR_EOF, sizeof(hdr->magic)) == 0) {
+        return 0;
+    }
+    if (memcmp(hdr->magic, OMAR_MAGIC, sizeof(hdr->magic)) != 0) {
+        fprintf(stderr, "omar: bad magic at offset %jd\n", (intmax_t)ar->cur);
+        return -EINVAL;
+    }
+
+    if (hdr->rev == OMAR_REV_REL) {
+        error = ar_relname(ar, ar->cur, hdr, ent->name, sizeof(ent->name));
+        if (error == 0 && hdr->type == OMAR_DIR) {
+            error = ar_dirput(ar, (ar->cur - ar->base) / BLOCK_SIZE, ent->name);
+        }
+        if (error != 0 && error != -ENOMEM) {
+            fprintf(stderr, "omar: bad relative name at offset %jd\n",
+                    (intmax_t)ar->cur);
+        }
+        if (error != 0) {
+            return error;
+        }
+    } else {
+        error = ar_read(ar, ar->cur + sizeof(*hdr), ent->name, hdr->namelen);
+        if (error != 0) {
+            fprintf(stderr, "omar: truncated archive\n");
+            return error;
+        }
+        ent->name[hdr->namelen] = '\0';
+    }
+
+    ent->dataoff = ar->cur + sizeof(*hdr) + omar_namesz(hdr);
+    ent->span = omar_span(hdr);
+    if (hdr->type != OMAR_DIR && ent->dataoff + hdr->len > ar->size) {
+        fprintf(stderr, "omar: %s: truncated entry\n", ent->name);
+        return -EIO;
+    }
+
+    ar->cur += ent->span;
+    if (hdr->type == OMAR_DEL) {
+        goto again;
+    }
+
+    return 1;
+}
+
+/*
+ * Go back to the first entry
+ */
+void
+ar_rewind(struct omar_ar *ar)
+{
+    ar->cur = ar->base;
+}
+
+/*
+ * Length of the contents of a file entry
+ */
+int
+ar_size(struct omar_ar *ar, const struct omar_hdr *hdr, off_t dataoff,
+        uint64_t *size)
+{
+    struct omar_chunkhdr ch;
+    int error;
+
+    if (hdr->type != OMAR_CHUNKED) {
+        *size = (hdr->type == OMAR_DIR) ? 0 : hdr->len;
+        return 0;
+    }
+
+    if ((error = ar_read(ar, dataoff, &ch, sizeof(ch))) != 0) {
+        return error;
+    }
+
+    *size = ch.size;
+    return 0;
+}
+
+/*
+ * Call @fn for each range of the archive holding bytes
+ * [@off, @off + @len) of a file's contents, in order.
+ * Chunked files are looked up through their chunk table.
+ */
+static int
+ar_ranges(struct omar_ar *ar, const struct omar_hdr *hdr, off_t dataoff,
+          uint64_t off, uint64_t len,
+          int(*fn)(void *arg, off_t where, size_t n), void *arg)
+{
+    struct omar_chunkhdr ch;
+    struct omar_chunk chunk;
+    uint64_t pos = 0, skip, n;
+    off_t tab, where;
+    uint32_t i;
+    int error;
+
+    if (hdr->type != OMAR_CHUNKED) {
+        if (off + len > hdr->len) {
+            return -EINVAL;
+        }
+        return (len == 0) ? 0 : fn(arg, dataoff + off, len);
+    }
+
+    if ((error = ar_read(ar, dataoff, &ch, sizeof(ch))) != 0) {
+        return error;
+    }
+
+    tab = dataoff + sizeof(ch);
+    for (i = 0; i < ch.nchunks && len > 0; ++i) {
+        error = ar_read(ar, tab + i * sizeof(chunk), &chunk, sizeof(chunk));
+        if (error != 0) {
+            return error;
+        }
+
+        if (off >= pos + chunk.len) {
+            pos += chunk.len;
+            continue;
+        }
+
+        skip = off - pos;
+        n = MIN(len, chunk.len - skip);
+        where = ar->base + chunk.off + skip;
+        if (where > ar->size || n > (uint64_t)(ar->size - where)) {
+            return -EIO;
+        }
+        if ((error = fn(arg, where, n)) != 0) {
+            return error;
+        }
+
+        pos += chunk.len;
+        off += n;
+        len -= n;
+    }
+
+    return (len == 0) ? 0 : -EINVAL;
+}
+
+/*
+ * Where ar_pread() and ar_copy() put the data
+ */
+struct ar_xfer {
+    struct omar_ar *ar;
+    struct omar_out *out;
+    char *buf;
+};
+
+static int
+ar_pread_range(void *arg, off_t where, size_t n)
+{
+    struct ar_xfer *xfer = arg;
+    int error;
+
+    if ((error = pread_all(xfer->ar->fd, xfer->buf, n, where)) == 0) {
+        xfer->buf += n;
+    }
+
+    return error;
+}
+
+static int
+ar_copy_range(void *arg, off_t where, size_t n)
+{
+    struct ar_xfer *xfer = arg;
+
+    return out_copy(xfer->out, xfer->ar->fd, where, n);
+}
+
+/*
+ * Read @len bytes at @off of a file's contents
+ */
+int
+ar_pread(struct omar_ar *ar, const struct omar_hdr *hdr, off_t dataoff,
+         void *buf, size_t len, uint64_t off)
+{
+    struct ar_xfer xfer = { ar, NULL, buf };
+
+    return ar_ranges(ar, hdr, dataoff, off, len, ar_pread_range, &xfer);
+}
+
+/*
+ * Copy @len bytes at @off of a file's contents to
+ * the output.
+ */
+int
+ar_copy(struct omar_ar *ar, const struct omar_hdr *hdr, off_t dataoff,
+        uint64_t off, uint64_t len, struct omar_out *out)
+{
+    struct ar_xfer xfer = { ar, out, NULL };
+
+    return ar_ranges(ar, hdr, dataoff, off, len, ar_copy_range, &xfer);
+}
+
+/*
+ * Write out a chunked file as a regular entry, and a
+ * parent relative name as a full one, for when entries
+ * are moved to another archive and their chunk or parent
+ * offsets would no longer hold.
+ */
+int
+ar_expand(struct omar_ar *ar, const struct omar_ent *ent, struct omar_out *out)
+{
+    struct omar_hdr hdr = ent->hdr;
+    uint64_t size = 0;
+    int error;
+
+    if (strlen(ent->name) > UINT8_MAX) {
+        fprintf(stderr, "omar: %s: name too long\n", ent->name);
+        return -ENAMETOOLONG;
+    }
+    if (hdr.type != OMAR_DIR &&
+        (error = ar_size(ar, &ent->hdr, ent->dataoff, &size)) != 0) {
+        return error;
+    }
+    if (size > UINT32_MAX) {
+        fprintf(stderr, "omar: %s: file too large\n", ent->name);
+        return -EFBIG;
+    }
+
+    hdr.rev = OMAR_REV;
+    hdr.namelen = strlen(ent->name);
+    if (hdr.type != OMAR_DIR) {
+        hdr.type = OMAR_REG;
+        hdr.len = size;
+    }
+
+    if ((error = out_write(out, &hdr, sizeof(hdr))) != 0) {
+        return error;
+    }
+    if ((error = out_write(out, ent->name, hdr.namelen)) != 0) {
+        return error;
+    }
+    error = ar_copy(ar, &ent->hdr, ent->dataoff, 0, size, out);
+    if (error != 0) {
+        return error;
+    }
+
+    return out_zero(out, omar_span(&hdr) - (sizeof(hdr) + hdr.namelen + size));
+}
+
+void
+ar_close(struct omar_ar *ar)
+{
+    size_t i;
+
+    close(ar->fd);
+    free(ar->win);
+    ar->win = NULL;
+    for (i = 0; i < ar->ndirs; ++i) {
+        free(ar->dirs[i].name);
+    }
+    free(ar->dirs);
+    ar->dirs = NULL;
+    ar->ndirs = 0;
+}
+
+int
+out_init(struct omar_out *out, int fd)
+{
+    out->fd = fd;
+    out->off = 0;
+    out->len = 0;
+    out->drop = false;
+    out->synced = 0;
+    out->dropped = 0;
+    out->buf = malloc(OUT_BUFSZ);
+    if (out->buf == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/*
+ * With @drop set, start writeback of what was written since
+ * the last step and drop the step before it from the page
+ * cache once it hit the disk. This keeps no more than two
+ * steps of output dirty or cached. Only a hint to the kernel,
+ * errors don't matter.
+ */
+static void
+out_behind(struct omar_out *out)
+{
+    off_t end;
+
+    end = out->off - out->len;
+    if (!out->drop || end - out->synced < BEHIND_STEP) {
+        return;
+    }
+
+    sync_file_range(out->fd, out->synced, end - out->synced,
+                    SYNC_FILE_RANGE_WRITE);
+    if (out->synced > out->dropped) {
+        sync_file_range(out->fd, out->dropped, out->synced - out->dropped,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(out->fd, out->dropped, out->synced - out->dropped,
+                      POSIX_FADV_DONTNEED);
+    }
+
+    out->dropped = out->synced;
+    out->synced = end;
+}
+
+/*
+ * Push out whatever is pending in the staging buffer
+ */
+int
+out_flush(struct omar_out *out)
+{
+    int error;
+
+    if (out->len == 0) {
+        return 0;
+    }
+
+    error = write_all(out->fd, out->buf, out->len);
+    out->len = 0;
+    if (error == 0) {
+        out_behind(out);
+    }
+    return error;
+}
+
+int
+out_write(struct omar_out *out, const void *buf, size_t len)
+{
+    const char *p = buf;
+    size_t n;
+    int error;
+
+    out->off += len;
+    if (out->fd < 0) {
+        return 0;
+    }
+
+    /* Large writes skip the staging buffer */
+    if (len >= OUT_BUFSZ) {
+        if ((error = out_flush(out)) != 0) {
+            return error;
+        }
+        if ((error = write_all(out->fd, p, len)) == 0) {
+            out_behind(out);
+        }
+        return error;
+    }
+
+    while (len > 0) {
+        n = MIN(len, OUT_BUFSZ - out->len);
+        memcpy(out->buf + out->len, p, n);
+        out->len += n;
+        p += n;
+        len -= n;
+
+        if (out->len == OUT_BUFSZ && (error = out_flush(out)) != 0) {
+            return error;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Emit @len zero bytes (e.g., block padding)
+ */
+int
+out_zero(struct omar_out *out, size_t len)
+{
+    size_t n;
+    int error;
+
+    while (len > 0) {
+        n = MIN(len, sizeof(zeroblk));
+        if ((error = out_write(out, zeroblk, n)) != 0) {
+            return error;
+        }
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Copy @len bytes at @inoff of @infd to the output. The
+ * kernel does the copy with copy_file_range() when it can,
+ * or sendfile() when the output is not a regular file (e.g.,
+ * a pipe), otherwise we bounce the data through memory.
+ */
+int
+out_copy(struct omar_out *out, int infd, off_t inoff, size_t len)
+{
+    struct stat sb;
+    char *buf;
+    ssize_t n;
+    off_t pos;
+    int error;
+
+    if ((error = out_flush(out)) != 0) {
+        return error;
+    }
+
+    out->off += len;
+    if (out->fd < 0) {
+        return 0;
+    }
+
+    /* Huge copies into a file are split over threads */
+    if (len >= PAR_COPY_MIN && fstat(out->fd, &sb) == 0 && S_ISREG(sb.st_mode) &&
+        (pos = lseek(out->fd, 0, SEEK_CUR)) >= 0) {
+        if ((error = par_copy(out->fd, pos, infd, inoff, len)) != 0) {
+            return error;
+        }
+        return (lseek(out->fd, pos + len, SEEK_SET) < 0) ? -errno : 0;
+    }
+
+    while (len > 0) {
+        n = copy_file_range(infd, &inoff, out->fd, NULL, len, 0);
+        if (n <= 0) {
+            break;
+        }
+        len -= n;
+    }
+
+    while (len > 0) {
+        n = sendfile(out->fd, infd, &inoff, len);
+        if (n <= 0) {
+            break;
+        }
+        len -= n;
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    buf = malloc(COPY_BUFSZ);
+    if (buf == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+
+    while (len > 0) {
+        n = MIN(len, COPY_BUFSZ);
+        if ((error = pread_all(infd, buf, n, inoff)) != 0) {
+            break;
+        }
+        if ((error = write_all(out->fd, buf, n)) != 0) {
+            break;
+        }
+        inoff += n;
+        len -= n;
+    }
+
+    free(buf);
+    return error;
+}
+
+/*
+ * Copy the next @len bytes of the stream @infd (e.g., a
+ * pipe) to the output. Pipes are spliced and files copied
+ * from their current position, both in the kernel, anything
+ * else is bounced through memory.
+ */
+int
+out_stream(struct omar_out *out, int infd, size_t len)
+{
+    char *buf;
+    ssize_t n;
+    int error;
+
+    if ((error = out_flush(out)) != 0) {
+        return error;
+    }
+
+    out->off += len;
+    while (len > 0) {
+        n = splice(infd, NULL, out->fd, NULL, MIN(len, COPY_BUFSZ), SPLICE_F_MOVE);
+        if (n <= 0) {
+            break;
+        }
+        len -= n;
+    }
+
+    while (len > 0) {
+        n = copy_file_range(infd, NULL, out->fd, NULL, len, 0);
+        if (n <= 0) {
+            break;
+        }
+        len -= n;
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    buf = malloc(COPY_BUFSZ);
+    if (buf == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+
+    while (len > 0) {
+        n = MIN(len, COPY_BUFSZ);
+        if ((error = read_all(infd, buf, n)) != 0) {
+            break;
+        }
+        if ((error = write_all(out->fd, buf, n)) != 0) {
+            break;
+        }
+        len -= n;
+    }
+
+    free(buf);
+    return error;
+}
+
+/*
+ * Write the EOF record and flush the output
+ */
+int
+out_eof(struct omar_out *out)
+{
+    struct omar_hdr hdr;
+    int error;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, OMAR_EOF, sizeof(hdr.magic));
+    hdr.type = OMAR_REG;
+    hdr.rev = OMAR_REV;
+    hdr.namelen = 3;
+
+    if ((error = out_write(out, &hdr, sizeof(hdr))) != 0) {
+        return error;
+    }
+    if ((error = out_write(out, "EOF", hdr.namelen)) != 0) {
+        return error;
+    }
+
+    return out_flush(out);
+}
+
+void
+out_fini(struct omar_out *out)
+{
+    /* Whatever is left was written after the last step */
+    if (out->drop && out->fd >= 0) {
+        sync_file_range(out->fd, out->dropped, 0,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(out->fd, out->dropped, 0, POSIX_FADV_DONTNEED);
+    }
+
+    free(out->buf);
+    out->buf = NULL;
+}
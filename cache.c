@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+#include <sys/errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <inttypes.h>
+#include "omar.h"
+
+/*
+ * The build cache directory holds entry blocks keyed by
+ * the SHA-256 of their contents (<dir>/<xx>/<sha256>.<head>)
+ * along with an index mapping a source file's (path, size,
+ * mtime, inode) to that hash. A blob is the file data laid
+ * out as in an archive, followed by the padding of an entry
+ * whose header and name take @head bytes of its first
+ * block. When a later build finds a source unchanged
+ * according to the index, the data and padding of its
+ * entry are spliced out of the cache in one go and the
+ * source is never opened.
+ */
+#define CACHE_INDEX     "index2"
+#define CACHE_BUFSZ     (1 << 20)
+
+/*
+ * An index record, followed by @pathlen
+ * bytes of pathname.
+ *
+ * @size: Source file size
+ * @mtime: Source mtime (seconds)
+ * @mtime_nsec: Source mtime (nanoseconds)
+ * @ino: Source inode number
+ * @sha: SHA-256 of the contents
+ * @xxh: XXH64 of the contents (--manifest)
+ * @pathlen: Length of the pathname
+ */
+struct cache_rec {
+    uint64_t size;
+    int64_t mtime;
+    int64_t mtime_nsec;
+    uint64_t ino;
+    uint8_t sha[32];
+    uint64_t xxh;
+    uint16_t pathlen;
+} __attribute__((packed));
+
+/*
+ * Path of the blob holding contents @sha laid out after
+ * @head bytes of header and name
+ */
+static void
+cache_blob(struct omar_cache *cache, const uint8_t *sha, size_t head,
+           char *buf, size_t len)
+{
+    size_t i, n;
+
+    n = snprintf(buf, len, "%s/%02x/", cache->dir, sha[0]);
+    for (i = 0; i < 32 && n + 2 < len; ++i) {
+        n += snprintf(buf + n, len - n, "%02x", sha[i]);
+    }
+    snprintf(buf + n, len - n, ".%zu", head % BLOCK_SIZE);
+}
+
+/*
+ * Length of a blob, the data and padding of an entry
+ */
+static inline uint64_t
+cache_bloblen(uint64_t size, size_t head)
+{
+    return ALIGN_UP(head + size, BLOCK_SIZE) - head;
+}
+
+static inline bool
+cache_match(const struct cache_rec *rec, const struct stat *sb)
+{
+    return rec->size == (uint64_t)sb->st_size &&
+        rec->mtime == sb->st_mtim.tv_sec &&
+        rec->mtime_nsec == sb->st_mtim.tv_nsec &&
+        rec->ino == sb->st_ino;
+}
+
+/*
+ * Remember a record, later records for the same
+ * path replace earlier ones.
+ */
+static int
+cache_insert(struct omar_cache *cache, const struct cache_rec *rec,
+             const char *path)
+{
+    void **slot;
+
+    if ((slot = map_put(&cache->map, path)) == NULL) {
+        return -ENOMEM;
+    }
+    if (*slot == NULL && (*slot = malloc(sizeof(*rec))) == NULL) {
+        return -ENOMEM;
+    }
+
+    memcpy(*slot, rec, sizeof(*rec));
+    return 0;
+}
+
+/*
+ * Load the cache index
+ */
+static int
+cache_load(struct omar_cache *cache)
+{
+    struct cache_rec rec;
+    char path[PATH_MAX];
+    FILE *fp;
+    int error = 0;
+
+    if ((fp = fdopen(dup(cache->idxfd), "rb")) == NULL) {
+        return -errno;
+    }
+
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        if (rec.pathlen >= sizeof(path) ||
+            fread(path, rec.pathlen, 1, fp) != 1) {
+            /* Torn record at the tail, ignore it */
+            break;
+        }
+
+        path[rec.pathlen] = '\0';
+        if ((error = cache_insert(cache, &rec, path)) != 0) {
+            break;
+        }
+    }
+
+    fclose(fp);
+    return error;
+}
+
+int
+cache_open(struct omar_cache *cache, const char *dir)
+{
+    char path[PATH_MAX];
+    int error;
+
+    memset(cache, 0, sizeof(*cache));
+    cache->dir = dir;
+    cache->idxfd = -1;
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        perror(dir);
+        return -errno;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dir, CACHE_INDEX);
+    cache->idxfd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (cache->idxfd < 0) {
+        perror(path);
+        return -errno;
+    }
+
+    cache->buf = malloc(CACHE_BUFSZ);
+    if (cache->buf == NULL || (error = cache_load(cache)) != 0) {
+        fprintf(stderr, "omar: failed to load build cache\n");
+        cache_close(cache);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/*
+ * Look up the entry blocks for @path, laid out after
+ * @head bytes of header and name. Returns a descriptor
+ * of the blob (data and padding) if the source is
+ * unchanged, otherwise a negative value.
+ *
+ * @sha: Set to the SHA-256 of the contents
+ * @xxh: Set to the XXH64 of the contents
+ */
+int
+cache_get(struct omar_cache *cache, const char *path, const struct stat *sb,
+          size_t head, uint8_t sha[32], uint64_t *xxh)
+{
+    struct cache_rec *rec;
+    struct stat blob_sb;
+    char blob[PATH_MAX];
+    void **slot;
+    int fd;
+
+    if ((slot = map_get(&cache->map, path)) == NULL) {
+        return -ENOENT;
+    }
+
+    rec = *slot;
+    if (!cache_match(rec, sb)) {
+        return -ESTALE;
+    }
+
+    cache_blob(cache, rec->sha, head, blob, sizeof(blob));
+    if ((fd = open(blob, O_RDONLY)) < 0) {
+        return -errno;
+    }
+    if (fstat(fd, &blob_sb) != 0 ||
+        (uint64_t)blob_sb.st_size != cache_bloblen(sb->st_size, head)) {
+        close(fd);
+        return -ESTALE;
+    }
+
+    memcpy(sha, rec->sha, sizeof(rec->sha));
+    *xxh = rec->xxh;
+    return fd;
+}
+
+/*
+ * Copy @sb->st_size bytes of @infd to the output, then
+ * the padding of an entry with @head bytes of header and
+ * name, while adding them to the cache.
+ *
+ * @sha: Set to the SHA-256 of the contents
+ * @xxh: Set to the XXH64 of the contents
+ */
+int
+cache_put(struct omar_cache *cache, const char *path, const struct stat *sb,
+          int infd, size_t head, struct omar_out *out, uint8_t sha[32],
+          uint64_t *xxh)
+{
+    struct cache_rec rec;
+    struct omar_sha256 shactx;
+    struct omar_xxh xxhctx;
+    char tmp[PATH_MAX];
+    char blob[PATH_MAX];
+    off_t off = 0;
+    ssize_t n;
+    size_t len, pad;
+    int fd, error;
+
+    snprintf(tmp, sizeof(tmp), "%s/tmp.XXXXXX", cache->dir);
+    fd = mkstemp(tmp);
+
+    sha256_init(&shactx);
+    xxh_init(&xxhctx, 0);
+    while (off < sb->st_size) {
+        len = sb->st_size - off;
+        if (len > CACHE_BUFSZ) {
+            len = CACHE_BUFSZ;
+        }
+        if ((n = read(infd, cache->buf, len)) <= 0) {
+            error = (n < 0) ? -errno : -EIO;
+            goto fail;
+        }
+
+        sha256_update(&shactx, cache->buf, n);
+        xxh_update(&xxhctx, cache->buf, n);
+        if ((error = out_write(out, cache->buf, n)) != 0) {
+            goto fail;
+        }
+
+        /* A cache we can't write to is not fatal */
+        if (fd >= 0 && write_all(fd, cache->buf, n) != 0) {
+            close(fd);
+            unlink(tmp);
+            fd = -1;
+        }
+        off += n;
+    }
+
+    sha256_final(&shactx, sha);
+    *xxh = xxh_final(&xxhctx);
+
+    /* The padding goes in the blob too, it is laid out already */
+    pad = cache_bloblen(sb->st_size, head) - sb->st_size;
+    memset(cache->buf, 0, pad);
+    if ((error = out_write(out, cache->buf, pad)) != 0) {
+        goto fail;
+    }
+    if (fd < 0) {
+        return 0;
+    }
+    if (write_all(fd, cache->buf, pad) != 0) {
+        error = 0;
+        goto fail;
+    }
+
+    close(fd);
+    rec.size = sb->st_size;
+    rec.mtime = sb->st_mtim.tv_sec;
+    rec.mtime_nsec = sb->st_mtim.tv_nsec;
+    rec.ino = sb->st_ino;
+    memcpy(rec.sha, sha, sizeof(rec.sha));
+    rec.xxh = *xxh;
+    rec.pathlen = strlen(path);
+
+    cache_blob(cache, rec.sha, head, blob, sizeof(blob));
+    *strrchr(blob, '/') = '\0';
+    mkdir(blob, 0755);
+    cache_blob(cache, rec.sha, head, blob, sizeof(blob));
+    if (rename(tmp, blob) != 0) {
+        unlink(tmp);
+        return 0;
+    }
+
+    /*
+     * Records go out with a single write() on an O_APPEND
+     * descriptor so concurrent builds don't interleave them.
+     * A short write would leave a torn record for the next
+     * build to stumble on, so it fails the build.
+     */
+    memcpy(cache->buf, &rec, sizeof(rec));
+    memcpy(cache->buf + sizeof(rec), path, rec.pathlen);
+    len = sizeof(rec) + rec.pathlen;
+    if ((n = write(cache->idxfd, cache->buf, len)) != (ssize_t)len) {
+        error = (n < 0) ? -errno : -EIO;
+        fprintf(stderr, "omar: failed to write the build cache index: %s\n",
+                strerror(-error));
+        return error;
+    }
+
+    return cache_insert(cache, &rec, path);
+fail:
+    if (fd >= 0) {
+        close(fd);
+        unlink(tmp);
+    }
+    return error;
+}
+
+void
+cache_close(struct omar_cache *cache)
+{
+    if (cache->idxfd >= 0) {
+        close(cache->idxfd);
+    }
+
+    map_free(&cache->map, true);
+    free(cache->buf);
+    cache->buf = NULL;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include "omar.h"
+
+static inline void
+cat_help(void)
+{
+    printf("Usage: omar cat [archive] [path]\n");
+}
+
+/*
+ * Find an entry by pathname, through the index if the
+ * archive has one or else by skipping from header to
+ * header. A Bloom filter, if any, turns most misses away
+ * first. Returns 0 if there is no such entry.
+ */
+static int
+cat_find(struct omar_ar *ar, const char *name, struct omar_ent *ent)
+{
+    struct omar_index idx;
+    struct omar_idxent *ie;
+    int error;
+
+    if ((error = bloom_check(ar, name)) == 0 || (error < 0 && error != -ENOENT)) {
+        return error;
+    }
+
+    if ((error = index_load(ar, &idx)) == -ENOENT) {
+        while ((error = ar_next(ar, ent)) > 0) {
+            if (strcmp(ent->name, name) == 0) {
+                return 1;
+            }
+        }
+        return error;
+    }
+    if (error != 0) {
+        return error;
+    }
+
+    if ((ie = index_find(&idx, name)) == NULL) {
+        index_free(&idx);
+        return 0;
+    }
+
+    /* ar_next() picks up at the indexed header */
+    ar->cur = ar->base + ie->off;
+    index_free(&idx);
+    return ar_next(ar, ent);
+}
+
+int
+cat_main(int argc, char **argv)
+{
+    struct omar_ent ent;
+    struct omar_out out;
+    struct omar_ar ar;
+    const char *path;
+    uint64_t size;
+    int optc, error;
+
+    while ((optc = getopt(argc, argv, "h")) != -1) {
+        switch (optc) {
+        case 'h':
+            cat_help();
+            return 0;
+        default:
+            cat_help();
+            return -1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        cat_help();
+        return -1;
+    }
+
+    /* Same form as the archive paths */
+    path = argv[optind + 1];
+    while (*path == '/') {
+        ++path;
+    }
+
+    if ((error = ar_open(&ar, argv[optind])) != 0) {
+        return error;
+    }
+
+    error = cat_find(&ar, path, &ent);
+    if (error == 0) {
+        fprintf(stderr, "omar: %s: no such file\n", argv[optind + 1]);
+        error = -ENOENT;
+    } else if (error > 0 && ent.hdr.type == OMAR_DIR) {
+        fprintf(stderr, "omar: %s: is a directory\n", argv[optind + 1]);
+        error = -EISDIR;
+    } else if (error > 0) {
+        /* The data goes from the archive to stdout in the kernel */
+        error = ar_size(&ar, &ent.hdr, ent.dataoff, &size);
+        if (error == 0 && (error = out_init(&out, STDOUT_FILENO)) == 0) {
+            error = ar_copy(&ar, &ent.hdr, ent.dataoff, 0, size, &out);
+            out_fini(&out);
+        }
+        if (error != 0) {
+            fprintf(stderr, "omar: cat failed: %s\n", strerror(-error));
+        }
+    }
+
+    ar_close(&ar);
+    return error;
+}
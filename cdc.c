@@ -0,0 +1,495 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/mman.h>
+#include <sys/errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <inttypes.h>
+#include "omar.h"
+
+/*
+ * Content defined chunking (FastCDC style). Large files
+ * are cut where a gear hash over the last 64 bytes hits a
+ * mask, so chunk boundaries follow the content and survive
+ * insertions and deletions. Chunks seen before are stored
+ * once and referenced from the chunk table of each entry.
+ *
+ * Chunk sizes are kept between CDC_MIN and CDC_MAX. Below
+ * CDC_AVG a cut needs the stricter mask (more bits) and
+ * past it the looser one, which keeps sizes near CDC_AVG.
+ */
+#define CDC_MIN         (16 * 1024)
+#define CDC_AVG         (64 * 1024)
+#define CDC_MAX         (256 * 1024)
+#define CDC_MASK_S      (~0ULL << (64 - 18))
+#define CDC_MASK_L      (~0ULL << (64 - 14))
+#define CDC_WINDOW      64
+
+/*
+ * Candidate cut points are found in parallel over fixed
+ * segments of the file, each task scanning CDC_LANES
+ * segments interleaved so the otherwise serial hash chain
+ * keeps the CPU busy. A gear hash only depends on the last
+ * CDC_WINDOW bytes, so segments can start anywhere and
+ * agree with a sequential scan.
+ */
+#define CDC_SEGSZ       (2 << 20)
+#define CDC_LANES       4
+
+/*
+ * A segment of the file being scanned
+ *
+ * @start: First byte of the segment
+ * @end: One past the last byte
+ * @cand: Cut candidates, (position << 1) | strong
+ * @ncand: Number of candidates
+ * @cap: Capacity of @cand
+ */
+struct cdc_seg {
+    size_t start;
+    size_t end;
+    uint64_t *cand;
+    size_t ncand;
+    size_t cap;
+};
+
+/*
+ * A chunk of the file being pushed
+ *
+ * @off: Offset within the file
+ * @len: Chunk length
+ * @digest: SHA-256 of the chunk, chunks are only shared
+ *          on a match so it has to be collision proof
+ * @where: Archive offset of its data
+ * @dup: Chunk already present in the archive
+ */
+struct cdc_cut {
+    size_t off;
+    uint32_t len;
+    uint8_t digest[32];
+    uint64_t where;
+    bool dup;
+};
+
+struct cdc_job {
+    const uint8_t *data;
+    size_t size;
+    struct cdc_seg *segs;
+    size_t nseg;
+    struct cdc_cut *cuts;
+    size_t ncuts;
+    bool nomem;
+};
+
+static uint64_t gear[256];
+
+/*
+ * Fill in the gear table, it must never change or
+ * chunks would stop matching across archives.
+ */
+static void
+cdc_gear(void)
+{
+    uint64_t x = 0x4F4D4152ULL, z;
+    size_t i;
+
+    for (i = 0; i < 256; ++i) {
+        z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+static inline void
+cdc_cand(struct cdc_job *job, struct cdc_seg *seg, size_t pos, uint64_t fp)
+{
+    uint64_t *cand;
+    size_t cap;
+
+    if (seg->ncand == seg->cap) {
+        cap = (seg->cap == 0) ? 64 : seg->cap * 2;
+        if ((cand = realloc(seg->cand, cap * sizeof(*cand))) == NULL) {
+            job->nomem = true;
+            return;
+        }
+        seg->cand = cand;
+        seg->cap = cap;
+    }
+
+    seg->cand[seg->ncand++] = (pos << 1) | ((fp & CDC_MASK_S) == 0);
+}
+
+/*
+ * Hash state right before @pos
+ */
+static inline uint64_t
+cdc_warm(const uint8_t *data, size_t pos)
+{
+    uint64_t fp = 0;
+    size_t i;
+
+    i = (pos < CDC_WINDOW) ? 0 : pos - CDC_WINDOW;
+    for (; i < pos; ++i) {
+        fp = (fp << 1) + gear[data[i]];
+    }
+
+    return fp;
+}
+
+static void
+cdc_scan_one(struct cdc_job *job, struct cdc_seg *seg, size_t from,
+             uint64_t fp)
+{
+    const uint8_t *data = job->data;
+    size_t i;
+
+    for (i = from; i < seg->end; ++i) {
+        fp = (fp << 1) + gear[data[i]];
+        if ((fp & CDC_MASK_L) == 0) {
+            cdc_cand(job, seg, i + 1, fp);
+        }
+    }
+}
+
+/*
+ * Find the cut candidates of a group of segments
+ */
+static void
+cdc_scan(void *arg, size_t task)
+{
+    struct cdc_job *job = arg;
+    const uint8_t *data = job->data;
+    struct cdc_seg *s0, *s1, *s2, *s3;
+    uint64_t f0, f1, f2, f3;
+    size_t i, n, first;
+
+    first = task * CDC_LANES;
+    if (job->nseg - first < CDC_LANES) {
+        for (i = first; i < job->nseg; ++i) {
+            cdc_scan_one(job, &job->segs[i], job->segs[i].start,
+                         cdc_warm(data, job->segs[i].start));
+        }
+        return;
+    }
+
+    s0 = &job->segs[first];
+    s1 = s0 + 1;
+    s2 = s0 + 2;
+    s3 = s0 + 3;
+    f0 = cdc_warm(data, s0->start);
+    f1 = cdc_warm(data, s1->start);
+    f2 = cdc_warm(data, s2->start);
+    f3 = cdc_warm(data, s3->start);
+
+    /* Only the last segment of the file can be short */
+    n = s3->end - s3->start;
+    for (i = 0; i < n; ++i) {
+        f0 = (f0 << 1) + gear[data[s0->start + i]];
+        f1 = (f1 << 1) + gear[data[s1->start + i]];
+        f2 = (f2 << 1) + gear[data[s2->start + i]];
+        f3 = (f3 << 1) + gear[data[s3->start + i]];
+
+        if ((f0 & CDC_MASK_L) == 0) {
+            cdc_cand(job, s0, s0->start + i + 1, f0);
+        }
+        if ((f1 & CDC_MASK_L) == 0) {
+            cdc_cand(job, s1, s1->start + i + 1, f1);
+        }
+        if ((f2 & CDC_MASK_L) == 0) {
+            cdc_cand(job, s2, s2->start + i + 1, f2);
+        }
+        if ((f3 & CDC_MASK_L) == 0) {
+            cdc_cand(job, s3, s3->start + i + 1, f3);
+        }
+    }
+
+    cdc_scan_one(job, s0, s0->start + n, f0);
+    cdc_scan_one(job, s1, s1->start + n, f1);
+    cdc_scan_one(job, s2, s2->start + n, f2);
+}
+
+static void
+cdc_hash(void *arg, size_t i)
+{
+    struct cdc_job *job = arg;
+    struct cdc_cut *cut = &job->cuts[i];
+    struct omar_sha256 sha;
+
+    sha256_init(&sha);
+    sha256_update(&sha, job->data + cut->off, cut->len);
+    sha256_final(&sha, cut->digest);
+}
+
+/*
+ * Pick the cut points out of the candidates. This is
+ * the sequential part of chunking but only looks at a
+ * few candidates per chunk.
+ */
+static int
+cdc_select(struct cdc_job *job)
+{
+    size_t pos = 0, seg = 0, k = 0, cut, lo, normal, limit, cap;
+    struct cdc_cut *cuts;
+    uint64_t c;
+
+    cap = job->size / CDC_MIN + 1;
+    if ((job->cuts = malloc(cap * sizeof(*job->cuts))) == NULL) {
+        return -ENOMEM;
+    }
+
+    while (pos < job->size) {
+        limit = job->size - pos > CDC_MAX ? pos + CDC_MAX : job->size;
+        lo = pos + CDC_MIN;
+        normal = pos + CDC_AVG;
+        cut = limit;
+
+        while (job->size - pos > CDC_MIN && seg < job->nseg) {
+            if (k == job->segs[seg].ncand) {
+                ++seg;
+                k = 0;
+                continue;
+            }
+
+            c = job->segs[seg].cand[k];
+            if ((c >> 1) <= lo) {
+                ++k;
+                continue;
+            }
+            if ((c >> 1) >= limit) {
+                break;
+            }
+            if ((c >> 1) > normal || (c & 1)) {
+                cut = c >> 1;
+                break;
+            }
+            ++k;
+        }
+
+        cuts = &job->cuts[job->ncuts++];
+        memset(cuts, 0, sizeof(*cuts));
+        cuts->off = pos;
+        cuts->len = cut - pos;
+        pos = cut;
+    }
+
+    return 0;
+}
+
+void
+cdc_init(struct omar_cdc *cdc, off_t base)
+{
+    memset(cdc, 0, sizeof(*cdc));
+    cdc->base = base;
+    cdc_gear();
+}
+
+/*
+ * Split up the contents of @infd
+ */
+static int
+cdc_split(struct cdc_job *job, int infd, size_t size)
+{
+    size_t i, ntask;
+    int error;
+
+    memset(job, 0, sizeof(*job));
+    job->size = size;
+    job->data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, infd, 0);
+    if (job->data == MAP_FAILED) {
+        return -errno;
+    }
+    madvise((void *)job->data, size, MADV_SEQUENTIAL);
+
+    job->nseg = (size + CDC_SEGSZ - 1) / CDC_SEGSZ;
+    if ((job->segs = calloc(job->nseg, sizeof(*job->segs))) == NULL) {
+        return -ENOMEM;
+    }
+    for (i = 0; i < job->nseg; ++i) {
+        job->segs[i].start = i * CDC_SEGSZ;
+        job->segs[i].end = (i + 1 == job->nseg) ? size : (i + 1) * CDC_SEGSZ;
+    }
+
+    ntask = (job->nseg + CDC_LANES - 1) / CDC_LANES;
+    par_for(ntask, cdc_scan, job);
+    if (job->nomem) {
+        return -ENOMEM;
+    }
+
+    if ((error = cdc_select(job)) != 0) {
+        return error;
+    }
+
+    par_for(job->ncuts, cdc_hash, job);
+    return 0;
+}
+
+static void
+cdc_free(struct cdc_job *job)
+{
+    size_t i;
+
+    for (i = 0; job->segs != NULL && i < job->nseg; ++i) {
+        free(job->segs[i].cand);
+    }
+    if (job->data != NULL && job->data != MAP_FAILED) {
+        munmap((void *)job->data, job->size);
+    }
+
+    free(job->segs);
+    free(job->cuts);
+}
+
+/*
+ * Push a file as a chunked entry. The entry data is the
+ * chunk table followed by the chunks not seen before.
+ *
+ * @mf: Manifest to hash the file for, NULL if none
+ */
+int
+cdc_push(struct omar_cdc *cdc, struct omar_out *out, int infd,
+         const struct stat *sb, const char *name, struct omar_manifest *mf)
+{
+    struct cdc_job job;
+    struct omar_chunkhdr ch;
+    struct omar_chunk chunk;
+    struct omar_hdr hdr;
+    struct cdc_cut *cut;
+    uint64_t where, newlen = 0;
+    char key[2 * 32 + 10];
+    void **slot;
+    size_t i, j, runoff = 0, runlen = 0;
+    int error;
+
+    if ((error = cdc_split(&job, infd, sb->st_size)) != 0) {
+        goto done;
+    }
+
+    /* The file was just scanned, hash it while it is mapped */
+    if (mf != NULL &&
+        (error = manifest_data(mf, name, job.data, job.size)) != 0) {
+        goto done;
+    }
+
+    /* Data of new chunks goes right after the table */
+    where = out->off - cdc->base + sizeof(hdr) + strlen(name);
+    where += sizeof(ch) + job.ncuts * sizeof(chunk);
+
+    for (i = 0; i < job.ncuts; ++i) {
+        cut = &job.cuts[i];
+        for (j = 0; j < sizeof(cut->digest); ++j) {
+            snprintf(&key[2 * j], 3, "%02x", cut->digest[j]);
+        }
+        snprintf(&key[2 * j], sizeof(key) - 2 * j, ":%" PRIx32, cut->len);
+        if ((slot = map_put(&cdc->chunks, key)) == NULL) {
+            error = -ENOMEM;
+            goto done;
+        }
+
+        ++cdc->nchunks;
+        if (*slot != NULL) {
+            cut->dup = true;
+            cut->where = *(uint64_t *)*slot;
+            cdc->dedup += cut->len;
+            continue;
+        }
+
+        if ((*slot = malloc(sizeof(uint64_t))) == NULL) {
+            error = -ENOMEM;
+            goto done;
+        }
+        cut->where = where + newlen;
+        *(uint64_t *)*slot = cut->where;
+        newlen += cut->len;
+        ++cdc->nunique;
+    }
+
+    if (sizeof(ch) + job.ncuts * sizeof(chunk) + newlen > UINT32_MAX) {
+        error = -EFBIG;
+        goto done;
+    }
+
+    memcpy(hdr.magic, OMAR_MAGIC, sizeof(hdr.magic));
+    hdr.type = OMAR_CHUNKED;
+    hdr.namelen = strlen(name);
+    hdr.len = sizeof(ch) + job.ncuts * sizeof(chunk) + newlen;
+    hdr.rev = OMAR_REV;
+    hdr.mode = sb->st_mode;
+    ch.size = sb->st_size;
+    ch.nchunks = job.ncuts;
+
+    error = out_write(out, &hdr, sizeof(hdr));
+    if (error == 0) {
+        error = out_write(out, name, hdr.namelen);
+    }
+    if (error == 0) {
+        error = out_write(out, &ch, sizeof(ch));
+    }
+    for (i = 0; i < job.ncuts && error == 0; ++i) {
+        chunk.off = job.cuts[i].where;
+        chunk.len = job.cuts[i].len;
+        error = out_write(out, &chunk, sizeof(chunk));
+    }
+
+    /* New chunks, adjacent ones in a single copy */
+    for (i = 0; i < job.ncuts && error == 0; ++i) {
+        cut = &job.cuts[i];
+        if (cut->dup) {
+            continue;
+        }
+        if (runlen > 0 && runoff + runlen != cut->off) {
+            error = out_copy(out, infd, runoff, runlen);
+            runlen = 0;
+        }
+        if (runlen == 0) {
+            runoff = cut->off;
+        }
+        runlen += cut->len;
+    }
+    if (error == 0 && runlen > 0) {
+        error = out_copy(out, infd, runoff, runlen);
+    }
+    if (error == 0) {
+        cdc->pad += omar_span(&hdr) - (sizeof(hdr) + hdr.namelen + hdr.len);
+        error = out_zero(out, omar_span(&hdr) -
+                         (sizeof(hdr) + hdr.namelen + hdr.len));
+    }
+done:
+    cdc_free(&job);
+    return error;
+}
+
+void
+cdc_fini(struct omar_cdc *cdc)
+{
+    map_free(&cdc->chunks, true);
+}
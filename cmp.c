@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include "omar.h"
+
+#define CMP_BUFSZ (64 * 1024)
+
+/*
+ * An entry being compared
+ *
+ * @hdr: Copy of the on-disk header
+ * @dataoff: Offset of the file data
+ * @size: Logical file size
+ */
+struct cmp_ent {
+    struct omar_hdr hdr;
+    off_t dataoff;
+    uint64_t size;
+};
+
+static inline void
+cmp_help(void)
+{
+    printf("Usage: omar cmp [-c] [archive] [archive]\n");
+    printf("-c      Also compare the data of files of the same size\n");
+}
+
+/*
+ * Get every path of an archive in sorted order, out
+ * of its index if it has one or else by walking the
+ * headers and sorting them.
+ */
+static int
+cmp_load(struct omar_ar *ar, struct omar_index *idx)
+{
+    struct omar_ent ent;
+    int error;
+
+    if ((error = index_load(ar, idx)) != -ENOENT) {
+        return error;
+    }
+
+    memset(idx, 0, sizeof(*idx));
+    while ((error = ar_next(ar, &ent)) > 0) {
+        if (index_add(idx, ent.name, ent.off - ar->base) != 0) {
+            fprintf(stderr, "out of memory\n");
+            return -ENOMEM;
+        }
+    }
+
+    index_sort(idx);
+    return error;
+}
+
+/*
+ * Read the header of an index entry
+ */
+static int
+cmp_get(struct omar_ar *ar, const struct omar_idxent *ie, struct cmp_ent *ent)
+{
+    off_t off;
+    int error;
+
+    off = ar->base + ie->off;
+    if ((error = ar_read(ar, off, &ent->hdr, sizeof(ent->hdr))) != 0) {
+        return error;
+    }
+    if (memcmp(ent->hdr.magic, OMAR_MAGIC, sizeof(ent->hdr.magic)) != 0) {
+        fprintf(stderr, "omar: bad magic at %jd\n", (intmax_t)off);
+        return -EINVAL;
+    }
+
+    ent->dataoff = off + sizeof(ent->hdr) + omar_namesz(&ent->hdr);
+    ent->size = 0;
+    if (ent->hdr.type == OMAR_DIR) {
+        return 0;
+    }
+
+    return ar_size(ar, &ent->hdr, ent->dataoff, &ent->size);
+}
+
+/*
+ * Compare the data of two files of the same size,
+ * returns 1 if they differ.
+ */
+static int
+cmp_data(struct omar_ar *ar, struct cmp_ent *a, struct omar_ar *br,
+         struct cmp_ent *b, char *buf)
+{
+    uint64_t off;
+    size_t n;
+    int error;
+
+    for (off = 0; off < a->size; off += n) {
+        n = (a->size - off < CMP_BUFSZ) ? a->size - off : CMP_BUFSZ;
+        error = ar_pread(ar, &a->hdr, a->dataoff, buf, n, off);
+        if (error == 0) {
+            error = ar_pread(br, &b->hdr, b->dataoff, buf + CMP_BUFSZ, n, off);
+        }
+        if (error != 0) {
+            return error;
+        }
+        if (memcmp(buf, buf + CMP_BUFSZ, n) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Tell whether an entry present in both archives changed.
+ * Data is only read when asked to and everything else
+ * matches.
+ *
+ * @full: Compare the data of files of the same size
+ */
+static int
+cmp_ent(struct omar_ar *ar, const struct omar_idxent *ia, struct omar_ar *br,
+        const struct omar_idxent *ib, bool full, char *buf)
+{
+    struct cmp_ent a, b;
+    int error;
+
+    if ((error = cmp_get(ar, ia, &a)) != 0 || (error = cmp_get(br, ib, &b)) != 0) {
+        return error;
+    }
+
+    if (OMAR_ISFILE(a.hdr.type) != OMAR_ISFILE(b.hdr.type) ||
+        a.hdr.mode != b.hdr.mode || a.size != b.size) {
+        return 1;
+    }
+    if (a.hdr.type == OMAR_DIR || !full) {
+        return 0;
+    }
+
+    return cmp_data(ar, &a, br, &b, buf);
+}
+
+int
+cmp_main(int argc, char **argv)
+{
+    struct omar_ar ar[2];
+    struct omar_index idx[2];
+    const char *na, *nb;
+    bool full = false, differ = false;
+    size_t i = 0, j = 0;
+    char *buf = NULL;
+    int optc, r, error;
+
+    /* -s (sizes only) is the default now, still taken */
+    while ((optc = getopt(argc, argv, "csh")) != -1) {
+        switch (optc) {
+        case 'c':
+            full = true;
+            break;
+        case 's':
+            full = false;
+            break;
+        case 'h':
+            cmp_help();
+            return 0;
+        default:
+            cmp_help();
+            return -1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        cmp_help();
+        return -1;
+    }
+
+    memset(idx, 0, sizeof(idx));
+    if ((error = ar_open(&ar[0], argv[optind])) != 0) {
+        return error;
+    }
+    if ((error = ar_open(&ar[1], argv[optind + 1])) != 0) {
+        ar_close(&ar[0]);
+        return error;
+    }
+
+    if ((buf = malloc(CMP_BUFSZ * 2)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        error = -ENOMEM;
+        goto done;
+    }
+    if ((error = cmp_load(&ar[0], &idx[0])) != 0 ||
+        (error = cmp_load(&ar[1], &idx[1])) != 0) {
+        goto done;
+    }
+
+    /* Both lists are sorted, walk them side by side */
+    while (i < idx[0].count || j < idx[1].count) {
+        na = (i < idx[0].count) ? idx[0].names + idx[0].ents[i].name : NULL;
+        nb = (j < idx[1].count) ? idx[1].names + idx[1].ents[j].name : NULL;
+
+        if (nb == NULL || (na != NULL && strcmp(na, nb) < 0)) {
+            printf("%s [removed]\n", na);
+            differ = true;
+            ++i;
+            continue;
+        }
+        if (na == NULL || strcmp(na, nb) > 0) {
+            printf("%s [added]\n", nb);
+            differ = true;
+            ++j;
+            continue;
+        }
+
+        r = cmp_ent(&ar[0], &idx[0].ents[i], &ar[1], &idx[1].ents[j],
+                    full, buf);
+        if (r < 0) {
+            error = r;
+            break;
+        }
+        if (r > 0) {
+            printf("%s [changed]\n", na);
+            differ = true;
+        }
+        ++i;
+        ++j;
+    }
+
+done:
+    if (error != 0) {
+        fprintf(stderr, "omar: cmp failed: %s\n", strerror(-error));
+    }
+    index_free(&idx[0]);
+    index_free(&idx[1]);
+    free(buf);
+    ar_close(&ar[0]);
+    ar_close(&ar[1]);
+    if (error != 0) {
+        return error;
+    }
+    return differ ? 1 : 0;
+}
@@ -0,0 +1,785 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+#include <sys/errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include "omar.h"
+
+/*
+ * 'omar convert' turns a cpio (newc) or tar (ustar, pax
+ * and GNU long names) stream into an OMAR archive in one
+ * pass. Headers are read as they come and file data goes
+ * straight from the input to the output, spliced by the
+ * kernel when the input is a pipe, so nothing but names
+ * is ever held in memory.
+ */
+
+#define TAR_BLOCK       512
+#define CPIO_HDRSZ      110
+
+/* Biggest pax header or GNU long name we take */
+#define CONV_METAMAX    (1 << 20)
+
+/*
+ * A file already in the output, hard links copy its data
+ * from there. For cpio, links seen before the data (which
+ * comes with the last one) wait in @pending.
+ *
+ * @off: Data offset in the output, -1 if not there yet
+ * @len: Length of the data
+ * @mode: File mode
+ */
+struct conv_file {
+    off_t off;
+    uint64_t len;
+    uint32_t mode;
+    char **pending;
+    size_t npending;
+};
+
+/*
+ * Conversion state
+ *
+ * @infd: Input stream
+ * @files: Files by path (tar) or device and inode (cpio)
+ * @dirs: Directories already in the output
+ * @index: Index being built, NULL if none
+ * @name: Path of the next tar entry (pax or GNU), if any
+ * @link: Link target of the next tar entry, if any
+ * @size: Size of the next tar entry (pax), if >= 0
+ * @readback: The output can be read back (hard links)
+ */
+struct conv {
+    int infd;
+    struct omar_out out;
+    struct omar_map files;
+    struct omar_map dirs;
+    struct omar_index *index;
+    char *name;
+    char *link;
+    int64_t size;
+    bool readback;
+};
+
+static inline void
+convert_help(void)
+{
+    printf("Usage: omar convert [-I] -o [output] < [cpio or tar]\n");
+    printf("-I      Write an index\n");
+}
+
+/*
+ * Throw away the next @len bytes of input
+ */
+static int
+conv_skip(struct conv *cv, uint64_t len)
+{
+    char buf[TAR_BLOCK * 8];
+    size_t n;
+    int error;
+
+    while (len > 0) {
+        n = (len < sizeof(buf)) ? len : sizeof(buf);
+        if ((error = read_all(cv->infd, buf, n)) != 0) {
+            return error;
+        }
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Read the next @len bytes of input as a string
+ */
+static int
+conv_meta(struct conv *cv, uint64_t len, char **res)
+{
+    char *p;
+    int error;
+
+    if (len > CONV_METAMAX) {
+        return -E2BIG;
+    }
+    if ((p = malloc(len + 1)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+    if ((error = read_all(cv->infd, p, len)) != 0) {
+        free(p);
+        return error;
+    }
+
+    p[len] = '\0';
+    *res = p;
+    return 0;
+}
+
+/*
+ * Turn a member name into an archive path, in place:
+ * no leading "./" or '/', no trailing '/'. Returns
+ * NULL for the top directory itself.
+ */
+static char *
+conv_path(char *name)
+{
+    size_t len;
+
+    for (;;) {
+        if (name[0] == '/') {
+            ++name;
+        } else if (name[0] == '.' && name[1] == '/') {
+            name += 2;
+        } else {
+            break;
+        }
+    }
+
+    len = strlen(name);
+    while (len > 0 && name[len - 1] == '/') {
+        name[--len] = '\0';
+    }
+    if (len == 0 || strcmp(name, ".") == 0) {
+        return NULL;
+    }
+
+    return name;
+}
+
+/*
+ * Write an entry header and name, the caller
+ * follows up with @len bytes of data.
+ */
+static int
+conv_hdr(struct conv *cv, const char *name, uint8_t type, uint32_t mode,
+         uint64_t len)
+{
+    struct omar_hdr hdr;
+    int error;
+
+    if (cv->index != NULL &&
+        (error = index_add(cv->index, name, cv->out.off)) != 0) {
+        return error;
+    }
+
+    memcpy(hdr.magic, OMAR_MAGIC, sizeof(hdr.magic));
+    hdr.type = type;
+    hdr.mode = mode;
+    hdr.len = len;
+    hdr.rev = OMAR_REV;
+    hdr.namelen = strlen(name);
+
+    if ((error = out_write(&cv->out, &hdr, sizeof(hdr))) != 0) {
+        return error;
+    }
+
+    return out_write(&cv->out, name, hdr.namelen);
+}
+
+/*
+ * Pad the entry that started at @start out to a block
+ */
+static int
+conv_pad(struct conv *cv, off_t start)
+{
+    return out_zero(&cv->out, ALIGN_UP(cv->out.off - start, BLOCK_SIZE) -
+                    (cv->out.off - start));
+}
+
+/*
+ * Add a directory entry, unless the output already has one
+ */
+static int
+conv_dir(struct conv *cv, const char *name, uint32_t mode)
+{
+    off_t start = cv->out.off;
+    int error;
+
+    if (map_get(&cv->dirs, name) != NULL) {
+        return 0;
+    }
+    if (map_put(&cv->dirs, name) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+
+    if ((error = conv_hdr(cv, name, OMAR_DIR, mode, 0)) != 0) {
+        return error;
+    }
+
+    return conv_pad(cv, start);
+}
+
+/*
+ * Streams may leave out the directories above an entry
+ * (e.g. "tar cf - d/f"), add the missing ones so the
+ * entry can be extracted.
+ */
+static int
+conv_parents(struct conv *cv, const char *name)
+{
+    char path[UINT8_MAX + 1], *slash;
+    int error;
+
+    snprintf(path, sizeof(path), "%s", name);
+    for (slash = strchr(path, '/'); slash != NULL;
+         slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if ((error = conv_dir(cv, path, S_IFDIR | 0755)) != 0) {
+            return error;
+        }
+        *slash = '/';
+    }
+
+    return 0;
+}
+
+/*
+ * Add an entry of the input. File data is taken from the
+ * input, or copied from an earlier file of the output if
+ * @src has its data there (hard links). Anything that is
+ * not a file or directory is skipped.
+ *
+ * @name: Path, as normalized by conv_path()
+ * @mode: File mode, with its type
+ * @len: Length of the data in the input
+ * @src: File this is a link to, or NULL
+ */
+static int
+conv_add(struct conv *cv, const char *name, uint32_t mode, uint64_t len,
+         struct conv_file *src)
+{
+    off_t start;
+    uint64_t size = len;
+    int error;
+
+    if (name == NULL) {
+        return conv_skip(cv, len);
+    }
+    if (strlen(name) > UINT8_MAX) {
+        fprintf(stderr, "omar: %s: name too long, skipped\n", name);
+        return conv_skip(cv, len);
+    }
+    if (!S_ISREG(mode) && !S_ISDIR(mode)) {
+        fprintf(stderr, "omar: %s: not a file or directory, skipped\n", name);
+        return conv_skip(cv, len);
+    }
+
+    if ((error = conv_parents(cv, name)) != 0) {
+        return error;
+    }
+    start = cv->out.off;
+
+    if (S_ISDIR(mode)) {
+        if ((error = conv_dir(cv, name, mode)) != 0) {
+            return error;
+        }
+        return conv_skip(cv, len);
+    }
+
+    /* The data of a link is copied back from the output */
+    if (src != NULL && src->off >= 0 && !cv->readback) {
+        fprintf(stderr, "omar: %s: hard links need an output file that "
+                "can be read back, not a pipe\n", name);
+        return -ESPIPE;
+    }
+    if (src != NULL && src->off >= 0) {
+        size = src->len;
+    }
+    if (size > UINT32_MAX) {
+        fprintf(stderr, "omar: %s: file too large\n", name);
+        return -EFBIG;
+    }
+
+    if ((error = conv_hdr(cv, name, OMAR_REG, mode, size)) != 0) {
+        return error;
+    }
+
+    if (src != NULL && src->off >= 0) {
+        error = out_copy(&cv->out, cv->out.fd, src->off, size);
+        if (error == 0) {
+            error = conv_skip(cv, len);
+        }
+    } else {
+        if (src != NULL) {
+            src->off = cv->out.off;
+            src->len = size;
+        }
+        error = out_stream(&cv->out, cv->infd, size);
+    }
+    if (error != 0) {
+        return error;
+    }
+
+    return conv_pad(cv, start);
+}
+
+/*
+ * Look up the file recorded under @key, adding it
+ */
+static struct conv_file *
+conv_file(struct conv *cv, const char *key)
+{
+    struct conv_file *f;
+    void **slot;
+
+    if ((slot = map_put(&cv->files, key)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return NULL;
+    }
+    if (*slot != NULL) {
+        return *slot;
+    }
+
+    if ((f = calloc(1, sizeof(*f))) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return NULL;
+    }
+
+    f->off = -1;
+    *slot = f;
+    return f;
+}
+
+/*
+ * Write out the links waiting on @f, as empty
+ * files if their data never came.
+ */
+static int
+conv_flush(struct conv *cv, struct conv_file *f)
+{
+    int error = 0;
+    size_t i;
+
+    for (i = 0; i < f->npending; ++i) {
+        if (error == 0) {
+            error = conv_add(cv, f->pending[i], f->mode, 0, f);
+        }
+        free(f->pending[i]);
+    }
+
+    free(f->pending);
+    f->pending = NULL;
+    f->npending = 0;
+    return error;
+}
+
+static uint64_t
+conv_hex(const char *p)
+{
+    char buf[9];
+
+    memcpy(buf, p, 8);
+    buf[8] = '\0';
+    return strtoull(buf, NULL, 16);
+}
+
+/*
+ * Convert a cpio newc stream, @magic being the
+ * first bytes of the first header.
+ */
+static int
+conv_cpio(struct conv *cv, const char *magic, size_t nmagic)
+{
+    char hdr[CPIO_HDRSZ], key[64];
+    char *name, *path, **p;
+    uint64_t mode, nlink, size, namesz;
+    struct conv_file *f;
+    int error;
+
+    memcpy(hdr, magic, nmagic);
+    if ((error = read_all(cv->infd, hdr + nmagic, sizeof(hdr) - nmagic)) != 0) {
+        return error;
+    }
+
+    for (;;) {
+        if (memcmp(hdr, "070701", 6) != 0 && memcmp(hdr, "070702", 6) != 0) {
+            fprintf(stderr, "omar: bad cpio header (only newc is supported)\n");
+            return -EINVAL;
+        }
+
+        mode = conv_hex(&hdr[14]);
+        nlink = conv_hex(&hdr[38]);
+        size = conv_hex(&hdr[54]);
+        namesz = conv_hex(&hdr[94]);
+
+        /* The name is padded so that the data is 4 byte aligned */
+        error = conv_meta(cv, ALIGN_UP(CPIO_HDRSZ + namesz, 4) - CPIO_HDRSZ, &name);
+        if (error != 0) {
+            return error;
+        }
+        name[(namesz > 0) ? namesz - 1 : 0] = '\0';
+        if (strcmp(name, "TRAILER!!!") == 0) {
+            free(name);
+            return 0;
+        }
+
+        path = conv_path(name);
+        f = NULL;
+        if (S_ISREG(mode) && nlink > 1 && path != NULL) {
+            snprintf(key, sizeof(key), "%.8s%.16s", &hdr[6], &hdr[62]);
+            if ((f = conv_file(cv, key)) == NULL) {
+                free(name);
+                return -ENOMEM;
+            }
+            f->mode = mode;
+        }
+
+        /* Links before the one with the data wait for it */
+        if (f != NULL && size == 0 && f->off < 0) {
+            p = realloc(f->pending, (f->npending + 1) * sizeof(*p));
+            if (p == NULL || (p[f->npending] = strdup(path)) == NULL) {
+                fprintf(stderr, "out of memory\n");
+                f->pending = (p != NULL) ? p : f->pending;
+                free(name);
+                return -ENOMEM;
+            }
+            f->pending = p;
+            ++f->npending;
+        } else {
+            error = conv_add(cv, path, mode, size, f);
+            if (error == 0 && f != NULL) {
+                error = conv_flush(cv, f);
+            }
+        }
+        free(name);
+        if (error == 0) {
+            error = conv_skip(cv, ALIGN_UP(size, 4) - size);
+        }
+        if (error == 0) {
+            error = read_all(cv->infd, hdr, sizeof(hdr));
+        }
+        if (error != 0) {
+            return error;
+        }
+    }
+}
+
+/*
+ * Parse a tar number, octal or base-256
+ */
+static uint64_t
+conv_num(const char *p, size_t len)
+{
+    uint64_t val = 0;
+    size_t i;
+
+    if ((uint8_t)p[0] & 0x80) {
+        val = (uint8_t)p[0] & 0x7F;
+        for (i = 1; i < len; ++i) {
+            val = (val << 8) | (uint8_t)p[i];
+        }
+        return val;
+    }
+
+    for (i = 0; i < len && (p[i] == ' ' || p[i] == '\0'); ++i);
+    for (; i < len && p[i] >= '0' && p[i] <= '7'; ++i) {
+        val = (val << 3) | (p[i] - '0');
+    }
+
+    return val;
+}
+
+/*
+ * Take the path, link path and size out of the
+ * records ("<len> <key>=<value>\n") of a pax header.
+ */
+static int
+conv_pax(struct conv *cv, char *buf, size_t len)
+{
+    char *p = buf, *key, *val, *end;
+    size_t reclen;
+
+    while (p < buf + len) {
+        reclen = strtoul(p, &key, 10);
+        if (reclen == 0 || *key != ' ' || p + reclen > buf + len ||
+            p[reclen - 1] != '\n') {
+            fprintf(stderr, "omar: bad pax header\n");
+            return -EINVAL;
+        }
+
+        end = p + reclen - 1;
+        *end = '\0';
+        if ((val = strchr(++key, '=')) != NULL) {
+            *val++ = '\0';
+            if (strcmp(key, "path") == 0) {
+                free(cv->name);
+                cv->name = strdup(val);
+            } else if (strcmp(key, "linkpath") == 0) {
+                free(cv->link);
+                cv->link = strdup(val);
+            } else if (strcmp(key, "size") == 0) {
+                cv->size = strtoll(val, NULL, 10);
+            }
+        }
+        p = end + 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Convert a tar stream, whose first header is in @blk
+ */
+static int
+conv_tar(struct conv *cv, char *blk)
+{
+    char name[256 + 1], link[100 + 1];
+    char *path, *target, *meta;
+    uint64_t size, sum, mode;
+    struct conv_file *f;
+    int error, i;
+
+    for (;;) {
+        /* A zero block ends the archive */
+        for (i = 0; i < TAR_BLOCK && blk[i] == '\0'; ++i);
+        if (i == TAR_BLOCK) {
+            return 0;
+        }
+
+        sum = 0;
+        for (i = 0; i < TAR_BLOCK; ++i) {
+            sum += (i >= 148 && i < 156) ? ' ' : (uint8_t)blk[i];
+        }
+        if (sum != conv_num(&blk[148], 8)) {
+            fprintf(stderr, "omar: bad tar header checksum\n");
+            return -EINVAL;
+        }
+
+        size = conv_num(&blk[124], 12);
+        if (cv->size >= 0) {
+            size = cv->size;
+        }
+        mode = conv_num(&blk[100], 8) & 07777;
+
+        if (cv->name == NULL) {
+            if (blk[345] != '\0' && memcmp(&blk[257], "ustar", 5) == 0) {
+                snprintf(name, sizeof(name), "%.155s/%.100s", &blk[345], blk);
+            } else {
+                snprintf(name, sizeof(name), "%.100s", blk);
+            }
+        } else {
+            snprintf(name, sizeof(name), "%s", cv->name);
+        }
+        snprintf(link, sizeof(link), "%.100s", &blk[157]);
+
+        error = 0;
+        switch (blk[156]) {
+        case 'x':
+        case 'L':
+        case 'K':
+            /* Metadata for the next entry */
+            if ((error = conv_meta(cv, ALIGN_UP(size, TAR_BLOCK), &meta)) != 0) {
+                break;
+            }
+            if (blk[156] == 'x') {
+                error = conv_pax(cv, meta, size);
+                free(meta);
+            } else if (blk[156] == 'L') {
+                free(cv->name);
+                cv->name = meta;
+            } else {
+                free(cv->link);
+                cv->link = meta;
+            }
+            size = 0;
+            break;
+        case '\0':
+        case '0':
+        case '7':
+        case '1':
+        case '5':
+            if (cv->name != NULL && strlen(cv->name) > UINT8_MAX) {
+                fprintf(stderr, "omar: %s: name too long, skipped\n", cv->name);
+                error = conv_skip(cv, size);
+                break;
+            }
+            path = conv_path(name);
+            if (blk[156] == '5') {
+                error = conv_add(cv, path, S_IFDIR | mode, size, NULL);
+                break;
+            }
+
+            /* Hard links copy the file they name */
+            f = NULL;
+            if (path != NULL && blk[156] == '1') {
+                if (cv->link != NULL) {
+                    snprintf(link, sizeof(link), "%s", cv->link);
+                }
+                target = conv_path(link);
+                f = (target != NULL) ? conv_file(cv, target) : NULL;
+                if (f == NULL || f->off < 0) {
+                    fprintf(stderr, "omar: %s: link target not found\n", path);
+                    error = -ENOENT;
+                    break;
+                }
+            } else if (path != NULL) {
+                /* A later copy of a path replaces the data */
+                if ((f = conv_file(cv, path)) == NULL) {
+                    error = -ENOMEM;
+                    break;
+                }
+                f->off = -1;
+            }
+            error = conv_add(cv, path, S_IFREG | mode, size, f);
+            break;
+        case 'g':
+            error = conv_skip(cv, size);
+            break;
+        default:
+            error = conv_add(cv, conv_path(name), 0, size, NULL);
+            break;
+        }
+
+        /* Overrides only hold for one entry */
+        if (blk[156] != 'x' && blk[156] != 'L' && blk[156] != 'K') {
+            free(cv->name);
+            free(cv->link);
+            cv->name = NULL;
+            cv->link = NULL;
+            cv->size = -1;
+        }
+
+        if (error == 0) {
+            error = conv_skip(cv, ALIGN_UP(size, TAR_BLOCK) - size);
+        }
+        if (error == 0) {
+            error = read_all(cv->infd, blk, TAR_BLOCK);
+        }
+        if (error != 0) {
+            return error;
+        }
+    }
+}
+
+int
+convert_main(int argc, char **argv)
+{
+    struct omar_index index = {0};
+    struct conv cv = {0};
+    struct conv_file *f;
+    const char *outpath = NULL;
+    bool want_index = false;
+    char blk[TAR_BLOCK];
+    int optc, fd, error;
+    size_t i;
+
+    while ((optc = getopt(argc, argv, "hIo:")) != -1) {
+        switch (optc) {
+        case 'I':
+            want_index = true;
+            break;
+        case 'o':
+            outpath = optarg;
+            break;
+        case 'h':
+            convert_help();
+            return 0;
+        default:
+            convert_help();
+            return -1;
+        }
+    }
+
+    if (outpath == NULL) {
+        fprintf(stderr, "omar: no output path\n");
+        convert_help();
+        return -1;
+    }
+
+    if (strcmp(outpath, "-") == 0) {
+        if (isatty(STDOUT_FILENO)) {
+            fprintf(stderr, "omar: refusing to write an archive to a terminal\n");
+            return -1;
+        }
+        fd = STDOUT_FILENO;
+    } else if ((fd = open(outpath, O_RDWR | O_CREAT | O_TRUNC, 0700)) < 0) {
+        printf("omar: failed to open output file\n");
+        return fd;
+    }
+
+    cv.infd = STDIN_FILENO;
+    cv.index = want_index ? &index : NULL;
+    cv.size = -1;
+    cv.readback = lseek(fd, 0, SEEK_CUR) >= 0 &&
+                  (fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDWR;
+    if ((error = out_init(&cv.out, fd)) != 0) {
+        close(fd);
+        return error;
+    }
+
+    /* cpio headers start with "0707", tar ones with a name */
+    if ((error = read_all(cv.infd, blk, 6)) == 0) {
+        if (memcmp(blk, "0707", 4) == 0) {
+            error = conv_cpio(&cv, blk, 6);
+        } else if ((error = read_all(cv.infd, blk + 6, TAR_BLOCK - 6)) == 0) {
+            error = conv_tar(&cv, blk);
+        }
+    }
+
+    /* Links whose data never came are empty files */
+    for (i = 0; i < cv.files.cap; ++i) {
+        if ((f = cv.files.tab[i].val) != NULL && f->npending > 0) {
+            if (error == 0) {
+                error = conv_flush(&cv, f);
+            } else {
+                cv.files.tab[i].val = NULL;
+                while (f->npending > 0) {
+                    free(f->pending[--f->npending]);
+                }
+                free(f->pending);
+                free(f);
+            }
+        }
+    }
+
+    /* Drain any trailing padding so the writer is not cut off */
+    while (error == 0 && read(cv.infd, blk, sizeof(blk)) > 0);
+
+    if (error == 0) {
+        error = out_finish(&cv.out, 0, cv.index);
+    }
+    if (error != 0) {
+        fprintf(stderr, "omar: convert failed: %s\n", strerror(-error));
+    }
+
+    out_fini(&cv.out);
+    close(fd);
+    map_free(&cv.files, true);
+    map_free(&cv.dirs, false);
+    index_free(&index);
+    free(cv.name);
+    free(cv.link);
+    return error;
+}
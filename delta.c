@@ -0,0 +1,938 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/mman.h>
+#include <sys/errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include "omar.h"
+
+/*
+ * An OMAR patch turns one archive into another. It is
+ * a list of operations, one per entry of the new archive
+ * in order, each either referencing an entry of the old
+ * archive or carrying data inline.
+ */
+#define PATCH_MAGIC "OMPT"
+#define PATCH_REV   2
+
+/* Patch operations */
+#define PATCH_END   0       /* Write the EOF record */
+#define PATCH_COPY  1       /* Copy an old entry as-is */
+#define PATCH_ENTRY 2       /* New entry carried inline */
+#define PATCH_DELTA 3       /* New entry built from an old one */
+
+/* Trailer sections of the new archive (patch_hdr.sects) */
+#define PATCH_SECT_INDEX    (1 << 0)
+#define PATCH_SECT_DIRS     (1 << 1)
+#define PATCH_SECT_BLOOM    (1 << 2)
+
+/* Delta commands (PATCH_DELTA) */
+#define DELTA_END   0
+#define DELTA_COPY  1       /* Copy a range of the old data */
+#define DELTA_LIT   2       /* Literal bytes follow */
+
+/* Granularity of delta matches */
+#define DELTA_BLKSZ 512
+
+/* Max candidates tried per rolling checksum hit */
+#define DELTA_MAXCHAIN 16
+
+/*
+ * The patch file header, followed by @mbrlen bytes of
+ * the MBR of the new archive. The trailer sections are
+ * rebuilt rather than carried, as the offsets in them
+ * change when chunked files get put back together.
+ *
+ * @magic: Patch magic ("OMPT")
+ * @rev: Patch revision
+ * @base: Digest of the headers of the archive this
+ *        patch applies to
+ * @sects: Trailer sections of the new archive (PATCH_SECT_*)
+ * @mbrlen: Length of the MBR of the new archive, if any
+ */
+struct patch_hdr {
+    char magic[4];
+    uint8_t rev;
+    uint64_t base;
+    uint8_t sects;
+    uint32_t mbrlen;
+} __attribute__((packed));
+
+/*
+ * A patch operation. For PATCH_COPY and PATCH_DELTA the
+ * old pathname follows, then PATCH_ENTRY and PATCH_DELTA
+ * carry the new header and name.
+ *
+ * @op: Operation (PATCH_*)
+ * @namelen: Length of the old pathname
+ * @hash: XXH64 of the old entry data
+ */
+struct patch_op {
+    uint8_t op;
+    uint8_t namelen;
+    uint64_t hash;
+} __attribute__((packed));
+
+/*
+ * A delta command, DELTA_LIT is followed by
+ * @len literal bytes.
+ *
+ * @cmd: Command (DELTA_*)
+ * @off: Offset within the old data (DELTA_COPY)
+ * @len: Number of bytes produced
+ */
+struct delta_cmd {
+    uint8_t cmd;
+    uint32_t off;
+    uint32_t len;
+} __attribute__((packed));
+
+/*
+ * An entry of the old archive
+ */
+struct old_ent {
+    struct omar_hdr hdr;
+    off_t off;
+    off_t dataoff;
+    off_t span;
+};
+
+/*
+ * A mapped archive
+ */
+struct delta_ar {
+    struct omar_ar ar;
+    const uint8_t *map;
+};
+
+/*
+ * A list of delta commands, for DELTA_LIT
+ * @off is the offset in the new data.
+ */
+struct delta_list {
+    struct delta_cmd *cmds;
+    size_t count;
+    size_t cap;
+    size_t litlen;
+};
+
+static inline void
+diff_help(void)
+{
+    printf("Usage: omar diff [old] [new] > [patch]\n");
+}
+
+static inline void
+patch_help(void)
+{
+    printf("Usage: omar patch [-c] [old] [patch] > [new]\n");
+    printf("-c      Verify the old entries against the patch\n");
+}
+
+/*
+ * Index the entries of the old archive by path and
+ * compute the digest over its headers.
+ */
+static int
+old_index(struct omar_ar *ar, struct omar_map *map, uint64_t *digest)
+{
+    struct omar_ent ent;
+    struct old_ent *old;
+    struct omar_xxh xxh;
+    void **slot;
+    int error;
+
+    xxh_init(&xxh, 0);
+    while ((error = ar_next(ar, &ent)) > 0) {
+        xxh_update(&xxh, &ent.hdr, sizeof(ent.hdr));
+        xxh_update(&xxh, ent.name, ent.hdr.namelen);
+
+        if ((slot = map_put(map, ent.name)) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return -ENOMEM;
+        }
+        if (*slot == NULL && (*slot = malloc(sizeof(*old))) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return -ENOMEM;
+        }
+
+        /* Later duplicates win, same as on extraction */
+        old = *slot;
+        old->hdr = ent.hdr;
+        old->off = ent.off;
+        old->dataoff = ent.dataoff;
+        old->span = ent.span;
+    }
+
+    *digest = xxh_final(&xxh);
+    return error;
+}
+
+static int
+delta_push(struct delta_list *dl, uint8_t cmd, uint32_t off, uint32_t len)
+{
+    struct delta_cmd *dc;
+    size_t cap;
+
+    /* Merge with the previous command if contiguous */
+    if (dl->count > 0) {
+        dc = &dl->cmds[dl->count - 1];
+        if (dc->cmd == cmd && dc->off + dc->len == off) {
+            dc->len += len;
+            goto done;
+        }
+    }
+
+    if (dl->count == dl->cap) {
+        cap = (dl->cap == 0) ? 64 : dl->cap * 2;
+        dc = realloc(dl->cmds, cap * sizeof(*dc));
+        if (dc == NULL) {
+            return -ENOMEM;
+        }
+        dl->cmds = dc;
+        dl->cap = cap;
+    }
+
+    dc = &dl->cmds[dl->count++];
+    dc->cmd = cmd;
+    dc->off = off;
+    dc->len = len;
+done:
+    if (cmd == DELTA_LIT) {
+        dl->litlen += len;
+    }
+    return 0;
+}
+
+/*
+ * Rolling checksum over a block, same as rsync's weak
+ * checksum. It can be slid along one byte at a time,
+ * so matches are found at any offset of the new data.
+ */
+static inline uint32_t
+delta_weak(const uint8_t *p, uint32_t *ap, uint32_t *bp)
+{
+    uint32_t a = 0, b = 0;
+    size_t i;
+
+    for (i = 0; i < DELTA_BLKSZ; ++i) {
+        a += p[i];
+        b += (DELTA_BLKSZ - i) * p[i];
+    }
+
+    *ap = a & 0xFFFF;
+    *bp = b & 0xFFFF;
+    return *ap | (*bp << 16);
+}
+
+/*
+ * Work out how to build @new out of @old
+ */
+static int
+delta_compute(const uint8_t *old, size_t oldlen, const uint8_t *new,
+              size_t newlen, struct delta_list *dl)
+{
+    uint32_t a, b, weak, mask, tabsz;
+    int32_t *head, *next, j;
+    size_t nblk, i, litoff;
+    int chain, error = 0;
+    bool hit;
+
+    nblk = oldlen / DELTA_BLKSZ;
+    if (nblk == 0 || newlen < DELTA_BLKSZ) {
+        return delta_push(dl, DELTA_LIT, 0, newlen);
+    }
+
+    for (tabsz = 64; tabsz < nblk * 2; tabsz <<= 1);
+    mask = tabsz - 1;
+    head = malloc(tabsz * sizeof(*head));
+    next = malloc(nblk * sizeof(*next));
+    if (head == NULL || next == NULL) {
+        error = -ENOMEM;
+        goto done;
+    }
+
+    memset(head, 0xFF, tabsz * sizeof(*head));
+    for (i = nblk; i-- > 0;) {
+        weak = delta_weak(&old[i * DELTA_BLKSZ], &a, &b);
+        next[i] = head[weak & mask];
+        head[weak & mask] = i;
+    }
+
+    i = 0;
+    litoff = 0;
+    weak = delta_weak(new, &a, &b);
+    for (;;) {
+        hit = false;
+        chain = 0;
+        for (j = head[weak & mask]; j >= 0 && chain < DELTA_MAXCHAIN;
+             j = next[j], ++chain) {
+            if (memcmp(&old[j * DELTA_BLKSZ], &new[i], DELTA_BLKSZ) == 0) {
+                hit = true;
+                break;
+            }
+        }
+
+        if (hit) {
+            if (i > litoff) {
+                error = delta_push(dl, DELTA_LIT, litoff, i - litoff);
+            }
+            if (error == 0) {
+                error = delta_push(dl, DELTA_COPY, j * DELTA_BLKSZ,
+                                   DELTA_BLKSZ);
+            }
+            if (error != 0) {
+                goto done;
+            }
+
+            i += DELTA_BLKSZ;
+            litoff = i;
+            if (i + DELTA_BLKSZ > newlen) {
+                break;
+            }
+            weak = delta_weak(&new[i], &a, &b);
+            continue;
+        }
+
+        if (i + DELTA_BLKSZ >= newlen) {
+            break;
+        }
+
+        /* Slide the window along by one byte */
+        a = (a - new[i] + new[i + DELTA_BLKSZ]) & 0xFFFF;
+        b = (b - DELTA_BLKSZ * new[i] + a) & 0xFFFF;
+        weak = a | (b << 16);
+        ++i;
+    }
+
+    if (litoff < newlen) {
+        error = delta_push(dl, DELTA_LIT, litoff, newlen - litoff);
+    }
+done:
+    free(head);
+    free(next);
+    return error;
+}
+
+static int
+delta_map(struct delta_ar *dar, const char *path)
+{
+    int error;
+
+    if ((error = ar_open(&dar->ar, path)) != 0) {
+        return error;
+    }
+    if (dar->ar.rel) {
+        fprintf(stderr, "omar: %s: relative names are not supported\n", path);
+        ar_close(&dar->ar);
+        return -ENOTSUP;
+    }
+
+    dar->map = mmap(NULL, dar->ar.size, PROT_READ, MAP_SHARED, dar->ar.fd, 0);
+    if (dar->map == MAP_FAILED) {
+        perror("mmap");
+        ar_close(&dar->ar);
+        return -errno;
+    }
+
+    return 0;
+}
+
+static void
+delta_unmap(struct delta_ar *dar)
+{
+    munmap((void *)dar->map, dar->ar.size);
+    ar_close(&dar->ar);
+}
+
+/*
+ * Contents of a file entry of a mapped archive. Chunked
+ * files are put back together in a buffer, which is
+ * released with delta_put().
+ */
+static const uint8_t *
+delta_get(struct delta_ar *dar, const struct omar_hdr *hdr, off_t dataoff,
+          uint64_t *lenp)
+{
+    const uint8_t *tab;
+    struct omar_chunkhdr ch;
+    struct omar_chunk chunk;
+    uint64_t pos = 0;
+    uint8_t *buf;
+    uint32_t i;
+
+    if (hdr->type != OMAR_CHUNKED) {
+        *lenp = (hdr->type == OMAR_DIR) ? 0 : hdr->len;
+        return dar->map + dataoff;
+    }
+
+    memcpy(&ch, dar->map + dataoff, sizeof(ch));
+    if (sizeof(ch) + (uint64_t)ch.nchunks * sizeof(chunk) > hdr->len) {
+        return NULL;
+    }
+    if ((buf = malloc(ch.size + 1)) == NULL) {
+        return NULL;
+    }
+
+    tab = dar->map + dataoff + sizeof(ch);
+    for (i = 0; i < ch.nchunks; ++i) {
+        memcpy(&chunk, tab + i * sizeof(chunk), sizeof(chunk));
+        if (dar->ar.base + chunk.off + chunk.len > (uint64_t)dar->ar.size ||
+            pos + chunk.len > ch.size) {
+            break;
+        }
+        memcpy(buf + pos, dar->map + dar->ar.base + chunk.off, chunk.len);
+        pos += chunk.len;
+    }
+
+    if (pos != ch.size) {
+        free(buf);
+        return NULL;
+    }
+
+    *lenp = ch.size;
+    return buf;
+}
+
+static inline void
+delta_put(const struct omar_hdr *hdr, const uint8_t *data)
+{
+    if (hdr->type == OMAR_CHUNKED) {
+        free((void *)data);
+    }
+}
+
+/*
+ * Emit the patch operation for one entry of the
+ * new archive. Chunked files end up as regular
+ * files in the patched archive.
+ */
+static int
+diff_entry(struct delta_ar *oar, struct omar_map *map,
+           struct delta_ar *nar, struct omar_ent *ent, struct omar_out *out)
+{
+    struct delta_list dl = {0};
+    struct patch_op op;
+    struct omar_hdr hdr = ent->hdr;
+    struct old_ent *old = NULL;
+    const uint8_t *odata = NULL, *ndata;
+    uint64_t olen = 0, len;
+    size_t i;
+    void **slot;
+    int error = 0;
+
+    if ((slot = map_get(map, ent->name)) != NULL) {
+        old = *slot;
+    }
+
+    if ((ndata = delta_get(nar, &ent->hdr, ent->dataoff, &len)) == NULL) {
+        fprintf(stderr, "omar: %s: bad chunked entry\n", ent->name);
+        return -EINVAL;
+    }
+    if (hdr.type == OMAR_CHUNKED) {
+        if (len > UINT32_MAX) {
+            fprintf(stderr, "omar: %s: file too large\n", ent->name);
+            delta_put(&ent->hdr, ndata);
+            return -EFBIG;
+        }
+        hdr.type = OMAR_REG;
+        hdr.len = len;
+    }
+
+    memset(&op, 0, sizeof(op));
+    op.op = PATCH_ENTRY;
+
+    if (old != NULL && OMAR_ISFILE(old->hdr.type) == OMAR_ISFILE(hdr.type)) {
+        odata = delta_get(oar, &old->hdr, old->dataoff, &olen);
+        if (odata == NULL) {
+            fprintf(stderr, "omar: %s: bad chunked entry\n", ent->name);
+            delta_put(&ent->hdr, ndata);
+            return -EINVAL;
+        }
+
+        op.namelen = ent->hdr.namelen;
+        op.hash = (old->hdr.type == OMAR_DIR) ? 0 : xxh64(odata, olen, 0);
+        if (old->hdr.type == hdr.type && old->hdr.mode == hdr.mode &&
+            olen == len && memcmp(odata, ndata, len) == 0) {
+            op.op = PATCH_COPY;
+        } else if (hdr.type == OMAR_REG && olen <= UINT32_MAX) {
+            /*
+             * Only bother with a delta if it saves a
+             * meaningful amount of data.
+             */
+            error = delta_compute(odata, olen, ndata, len, &dl);
+            if (error == 0 && dl.litlen < len - len / 4) {
+                op.op = PATCH_DELTA;
+            }
+        }
+        delta_put(&old->hdr, odata);
+    }
+
+    if (op.op == PATCH_ENTRY) {
+        op.namelen = 0;
+        op.hash = 0;
+    }
+
+    if (error == 0) {
+        error = out_write(out, &op, sizeof(op));
+    }
+    if (error == 0 && op.namelen > 0) {
+        error = out_write(out, ent->name, op.namelen);
+    }
+    if (error != 0 || op.op == PATCH_COPY) {
+        goto done;
+    }
+
+    error = out_write(out, &hdr, sizeof(hdr));
+    if (error == 0) {
+        error = out_write(out, ent->name, hdr.namelen);
+    }
+    if (error != 0 || op.op == PATCH_ENTRY) {
+        if (error == 0) {
+            error = out_write(out, ndata, len);
+        }
+        goto done;
+    }
+
+    for (i = 0; i < dl.count && error == 0; ++i) {
+        error = out_write(out, &dl.cmds[i], sizeof(dl.cmds[i]));
+        if (error == 0 && dl.cmds[i].cmd == DELTA_LIT) {
+            error = out_write(out, ndata + dl.cmds[i].off, dl.cmds[i].len);
+        }
+    }
+    if (error == 0) {
+        error = out_write(out, &(struct delta_cmd){DELTA_END, 0, 0},
+                          sizeof(struct delta_cmd));
+    }
+done:
+    free(dl.cmds);
+    delta_put(&ent->hdr, ndata);
+    return error;
+}
+
+/*
+ * omar diff old new > patch
+ */
+int
+diff_main(int argc, char **argv)
+{
+    struct delta_ar oar, nar;
+    struct omar_map map = {0};
+    struct omar_ent ent;
+    struct omar_out out;
+    struct patch_hdr hdr;
+    struct patch_op op;
+    uint64_t digest;
+    size_t len;
+    off_t off;
+    int optc, error;
+
+    while ((optc = getopt(argc, argv, "h")) != -1) {
+        switch (optc) {
+        case 'h':
+            diff_help();
+            return 0;
+        default:
+            diff_help();
+            return -1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        diff_help();
+        return -1;
+    }
+    if (isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "omar: refusing to write a patch to a terminal\n");
+        return -1;
+    }
+
+    if ((error = delta_map(&oar, argv[optind])) != 0) {
+        return error;
+    }
+    if ((error = delta_map(&nar, argv[optind + 1])) != 0) {
+        delta_unmap(&oar);
+        return error;
+    }
+    if ((error = out_init(&out, STDOUT_FILENO)) != 0) {
+        goto done;
+    }
+
+    memcpy(hdr.magic, PATCH_MAGIC, sizeof(hdr.magic));
+    hdr.rev = PATCH_REV;
+    if ((error = old_index(&oar.ar, &map, &digest)) != 0) {
+        goto done;
+    }
+    hdr.base = digest;
+    hdr.sects = 0;
+    if (ar_sect(&nar.ar, OMAR_SECT_INDEX, &off, &len) == 0) {
+        hdr.sects |= PATCH_SECT_INDEX;
+    }
+    if (ar_sect(&nar.ar, OMAR_SECT_DIRS, &off, &len) == 0) {
+        hdr.sects |= PATCH_SECT_DIRS;
+    }
+    if (ar_sect(&nar.ar, OMAR_SECT_BLOOM, &off, &len) == 0) {
+        hdr.sects |= PATCH_SECT_BLOOM;
+    }
+    hdr.mbrlen = nar.ar.base;
+    if ((error = out_write(&out, &hdr, sizeof(hdr))) != 0) {
+        goto done;
+    }
+    if ((error = out_write(&out, nar.map, hdr.mbrlen)) != 0) {
+        goto done;
+    }
+
+    while ((error = ar_next(&nar.ar, &ent)) > 0) {
+        if ((error = diff_entry(&oar, &map, &nar, &ent, &out)) != 0) {
+            break;
+        }
+    }
+
+    if (error == 0) {
+        memset(&op, 0, sizeof(op));
+        op.op = PATCH_END;
+        error = out_write(&out, &op, sizeof(op));
+    }
+    if (error == 0) {
+        error = out_flush(&out);
+    }
+done:
+    if (error != 0) {
+        fprintf(stderr, "omar: diff failed: %s\n", strerror(-error));
+    }
+    out_fini(&out);
+    map_free(&map, true);
+    delta_unmap(&nar);
+    delta_unmap(&oar);
+    return error;
+}
+
+static int
+patch_read(FILE *fp, void *buf, size_t len)
+{
+    if (len > 0 && fread(buf, len, 1, fp) != 1) {
+        fprintf(stderr, "omar: truncated patch\n");
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/*
+ * Pass @len literal bytes of the patch through
+ */
+static int
+patch_stream(FILE *fp, struct omar_out *out, size_t len)
+{
+    char buf[4096];
+    size_t n;
+    int error;
+
+    while (len > 0) {
+        n = (len < sizeof(buf)) ? len : sizeof(buf);
+        if ((error = patch_read(fp, buf, n)) != 0) {
+            return error;
+        }
+        if ((error = out_write(out, buf, n)) != 0) {
+            return error;
+        }
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Look up the old entry an operation refers to, its
+ * name goes to @name (256 bytes).
+ */
+static int
+patch_old(FILE *fp, struct omar_ar *ar, struct omar_map *map,
+          struct patch_op *op, bool verify, char *name, struct old_ent **res)
+{
+    struct omar_xxh xxh;
+    struct old_ent *old;
+    char buf[4096];
+    uint64_t off, size;
+    size_t n;
+    void **slot;
+    int error;
+
+    if ((error = patch_read(fp, name, op->namelen)) != 0) {
+        return error;
+    }
+
+    name[op->namelen] = '\0';
+    if ((slot = map_get(map, name)) == NULL) {
+        fprintf(stderr, "omar: %s: not in the old archive\n", name);
+        return -ENOENT;
+    }
+
+    old = *slot;
+    *res = old;
+    if (!verify || old->hdr.type == OMAR_DIR) {
+        return 0;
+    }
+
+    if ((error = ar_size(ar, &old->hdr, old->dataoff, &size)) != 0) {
+        return error;
+    }
+
+    xxh_init(&xxh, 0);
+    for (off = 0; off < size; off += n) {
+        n = (size - off < sizeof(buf)) ? size - off : sizeof(buf);
+        error = ar_pread(ar, &old->hdr, old->dataoff, buf, n, off);
+        if (error != 0) {
+            return error;
+        }
+        xxh_update(&xxh, buf, n);
+    }
+
+    if (xxh_final(&xxh) != op->hash) {
+        fprintf(stderr, "omar: %s: old entry does not match\n", name);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/*
+ * Rebuild a PATCH_ENTRY or PATCH_DELTA entry
+ *
+ * @idx: Index of the new archive, NULL if it has none
+ * @base: Output offset of the first header
+ */
+static int
+patch_entry(FILE *fp, struct omar_ar *ar, struct old_ent *old,
+            struct omar_index *idx, off_t base, struct omar_out *out)
+{
+    struct omar_hdr hdr;
+    struct delta_cmd dc;
+    char name[256];
+    size_t len, done = 0;
+    int error;
+
+    if ((error = patch_read(fp, &hdr, sizeof(hdr))) != 0) {
+        return error;
+    }
+    if ((error = patch_read(fp, name, hdr.namelen)) != 0) {
+        return error;
+    }
+    name[hdr.namelen] = '\0';
+    if (idx != NULL && (error = index_add(idx, name, out->off - base)) != 0) {
+        return error;
+    }
+    if ((error = out_write(out, &hdr, sizeof(hdr))) != 0) {
+        return error;
+    }
+    if ((error = out_write(out, name, hdr.namelen)) != 0) {
+        return error;
+    }
+
+    len = (hdr.type == OMAR_DIR) ? 0 : hdr.len;
+    if (old == NULL) {
+        error = patch_stream(fp, out, len);
+        goto pad;
+    }
+
+    for (;;) {
+        if ((error = patch_read(fp, &dc, sizeof(dc))) != 0) {
+            return error;
+        }
+        if (dc.cmd == DELTA_END) {
+            break;
+        }
+
+        if (done + dc.len > len) {
+            error = -EINVAL;
+        } else if (dc.cmd == DELTA_LIT) {
+            error = patch_stream(fp, out, dc.len);
+        } else if (dc.cmd == DELTA_COPY) {
+            error = ar_copy(ar, &old->hdr, old->dataoff, dc.off, dc.len, out);
+        } else {
+            error = -EINVAL;
+        }
+
+        if (error != 0) {
+            return error;
+        }
+        done += dc.len;
+    }
+
+    if (done != len) {
+        fprintf(stderr, "omar: bad delta\n");
+        return -EINVAL;
+    }
+pad:
+    if (error != 0) {
+        return error;
+    }
+    return out_zero(out, omar_span(&hdr) - (sizeof(hdr) + hdr.namelen + len));
+}
+
+/*
+ * omar patch [-c] old patch > new
+ */
+int
+patch_main(int argc, char **argv)
+{
+    struct omar_index index = {0}, *idx = NULL;
+    struct omar_map map = {0};
+    struct omar_ar ar;
+    struct omar_out out;
+    struct patch_hdr hdr;
+    struct patch_op op;
+    struct old_ent *old;
+    uint64_t digest;
+    char name[256], mbr[BLOCK_SIZE];
+    bool verify = false;
+    int optc, error;
+    FILE *fp;
+
+    while ((optc = getopt(argc, argv, "hc")) != -1) {
+        switch (optc) {
+        case 'c':
+            verify = true;
+            break;
+        case 'h':
+            patch_help();
+            return 0;
+        default:
+            patch_help();
+            return -1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        patch_help();
+        return -1;
+    }
+    if (isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "omar: refusing to write an archive to a terminal\n");
+        return -1;
+    }
+
+    if ((error = ar_open(&ar, argv[optind])) != 0) {
+        return error;
+    }
+    if (ar.rel) {
+        fprintf(stderr, "omar: %s: relative names are not supported\n",
+                argv[optind]);
+        ar_close(&ar);
+        return -ENOTSUP;
+    }
+    if ((fp = fopen(argv[optind + 1], "rb")) == NULL) {
+        perror(argv[optind + 1]);
+        ar_close(&ar);
+        return -errno;
+    }
+    if ((error = out_init(&out, STDOUT_FILENO)) != 0) {
+        goto done;
+    }
+
+    if ((error = patch_read(fp, &hdr, sizeof(hdr))) != 0) {
+        goto done;
+    }
+    if (memcmp(hdr.magic, PATCH_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.rev != PATCH_REV || hdr.mbrlen > sizeof(mbr)) {
+        fprintf(stderr, "omar: %s: not an OMAR patch\n", argv[optind + 1]);
+        error = -EINVAL;
+        goto done;
+    }
+
+    if ((error = old_index(&ar, &map, &digest)) != 0) {
+        goto done;
+    }
+    if (digest != hdr.base) {
+        fprintf(stderr, "omar: patch does not apply to %s\n", argv[optind]);
+        error = -EINVAL;
+        goto done;
+    }
+
+    /* The MBR comes first, the rest is relative to the first header */
+    if ((error = patch_read(fp, mbr, hdr.mbrlen)) != 0) {
+        goto done;
+    }
+    if ((error = out_write(&out, mbr, hdr.mbrlen)) != 0) {
+        goto done;
+    }
+    if (hdr.sects & PATCH_SECT_INDEX) {
+        idx = &index;
+        idx->dirs = (hdr.sects & PATCH_SECT_DIRS) != 0;
+        idx->bloom = (hdr.sects & PATCH_SECT_BLOOM) != 0;
+    }
+
+    for (;;) {
+        if ((error = patch_read(fp, &op, sizeof(op))) != 0) {
+            break;
+        }
+
+        old = NULL;
+        if (op.op == PATCH_COPY || op.op == PATCH_DELTA) {
+            error = patch_old(fp, &ar, &map, &op, verify, name, &old);
+            if (error != 0) {
+                break;
+            }
+        }
+
+        if (op.op == PATCH_END) {
+            error = out_finish(&out, hdr.mbrlen, idx);
+            break;
+        } else if (op.op == PATCH_COPY) {
+            if (idx != NULL) {
+                error = index_add(idx, name, out.off - hdr.mbrlen);
+            }
+            if (error == 0) {
+                error = out_copy(&out, ar.fd, old->off, old->span);
+            }
+        } else if (op.op == PATCH_ENTRY || op.op == PATCH_DELTA) {
+            error = patch_entry(fp, &ar, old, idx, hdr.mbrlen, &out);
+        } else {
+            fprintf(stderr, "omar: bad patch operation %d\n", op.op);
+            error = -EINVAL;
+        }
+
+        if (error != 0) {
+            break;
+        }
+    }
+done:
+    if (error != 0) {
+        fprintf(stderr, "omar: patch failed: %s\n", strerror(-error));
+    }
+    out_fini(&out);
+    map_free(&map, true);
+    index_free(&index);
+    fclose(fp);
+    ar_close(&ar);
+    return error;
+}
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include "omar.h"
+
+/*
+ * --emit-c turns an image into something a C program links
+ * in: <base>.S pulls the image in with .incbin, <base>.c has
+ * a static table of every entry and <base>.h declares it.
+ * Lookups go through a perfect hash built here, so nothing
+ * is parsed at startup whatever the size of the image.
+ *
+ * The hash is hash and displace: a path first picks a bucket,
+ * and the bucket's displacement seeds a second hash picking
+ * the path's slot. Displacements are searched for biggest
+ * bucket first until no two paths share a slot.
+ */
+
+/* Paths per bucket, on average */
+#define EMIT_BUCKET     4
+
+/* Displacements tried per bucket before growing the table */
+#define EMIT_MAXDISP    (1 << 16)
+
+/*
+ * Seeded 32 bit FNV-1a with a final mix. The
+ * generated lookup has the very same function.
+ */
+static uint32_t
+emit_hash(const char *s, uint32_t seed)
+{
+    uint32_t hash = 0x811C9DC5 ^ seed;
+
+    while (*s != '\0') {
+        hash ^= (uint8_t)*s++;
+        hash *= 0x01000193;
+    }
+
+    hash ^= hash >> 16;
+    hash *= 0x7FEB352D;
+    hash ^= hash >> 15;
+    return hash;
+}
+
+/*
+ * Record an entry of the image
+ *
+ * @name: Archive path
+ * @mode: File mode
+ * @off: Offset of the data within the image file
+ * @size: Length of the data
+ */
+int
+emit_add(struct omar_emit *emit, const char *name, mode_t mode, off_t off,
+         uint64_t size)
+{
+    struct omar_emitent *p;
+
+    if (emit->count == emit->cap) {
+        emit->cap = (emit->cap == 0) ? 256 : emit->cap * 2;
+        if ((p = realloc(emit->ents, emit->cap * sizeof(*p))) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return -ENOMEM;
+        }
+        emit->ents = p;
+    }
+
+    p = &emit->ents[emit->count];
+    if ((p->name = strdup(name)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+    p->mode = mode;
+    p->off = off;
+    p->size = size;
+    ++emit->count;
+    return 0;
+}
+
+/*
+ * Find a displacement for every bucket
+ *
+ * @slots: Filled with entry index + 1 for each slot, 0 if free
+ * @disp: Filled with the displacement of each bucket
+ *
+ * Returns false if some bucket has no displacement.
+ */
+static bool
+emit_place(const struct omar_emit *emit, uint32_t nbuckets, uint32_t nslots,
+           uint32_t *slots, uint32_t *disp)
+{
+    uint32_t *first, *next, *order, *pos;
+    uint32_t b, i, j, k, d, n, tmp;
+    bool ok = false;
+
+    n = emit->count;
+    first = malloc(nbuckets * sizeof(*first));
+    order = malloc(nbuckets * sizeof(*order));
+    next = malloc((n + 1) * sizeof(*next));
+    pos = malloc((n + 1) * sizeof(*pos));
+    if (first == NULL || order == NULL || next == NULL || pos == NULL) {
+        goto done;
+    }
+
+    /* Chain the paths of each bucket, sizes go in disp for now */
+    memset(slots, 0, nslots * sizeof(*slots));
+    memset(disp, 0, nbuckets * sizeof(*disp));
+    for (b = 0; b < nbuckets; ++b) {
+        first[b] = UINT32_MAX;
+        order[b] = b;
+    }
+    for (i = 0; i < n; ++i) {
+        b = emit_hash(emit->ents[i].name, 0) % nbuckets;
+        next[i] = first[b];
+        first[b] = i;
+        ++disp[b];
+    }
+
+    /* Biggest buckets first, while the table is empty */
+    for (i = 1; i < nbuckets; ++i) {
+        tmp = order[i];
+        for (j = i; j > 0 && disp[order[j - 1]] < disp[tmp]; --j) {
+            order[j] = order[j - 1];
+        }
+        order[j] = tmp;
+    }
+
+    for (k = 0; k < nbuckets; ++k) {
+        b = order[k];
+        disp[b] = 0;
+        if (first[b] == UINT32_MAX) {
+            continue;
+        }
+
+        for (d = 1; d < EMIT_MAXDISP; ++d) {
+            for (i = first[b], j = 0; i != UINT32_MAX; i = next[i], ++j) {
+                pos[j] = emit_hash(emit->ents[i].name, d) % nslots;
+                if (slots[pos[j]] != 0) {
+                    break;
+                }
+                slots[pos[j]] = i + 1;
+            }
+            if (i == UINT32_MAX) {
+                break;
+            }
+
+            /* Undo the slots this displacement took */
+            while (j-- > 0) {
+                slots[pos[j]] = 0;
+            }
+        }
+        if (d == EMIT_MAXDISP) {
+            goto done;
+        }
+        disp[b] = d;
+    }
+
+    ok = true;
+done:
+    free(first);
+    free(order);
+    free(next);
+    free(pos);
+    return ok;
+}
+
+/*
+ * Write a C string literal
+ */
+static void
+emit_str(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s != '\0'; ++s) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(fp, "\\%c", *s);
+        } else if (isprint((unsigned char)*s) && *s != '?') {
+            fputc(*s, fp);
+        } else {
+            fprintf(fp, "\\%03o", (unsigned char)*s);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void
+emit_table(FILE *fp, const char *type, const char *name, const uint32_t *tab,
+           uint32_t n)
+{
+    uint32_t i;
+
+    fprintf(fp, "static const %s %s[%" PRIu32 "] = {", type, name, n);
+    for (i = 0; i < n; ++i) {
+        fprintf(fp, "%s%" PRIu32 ",", (i % 8 == 0) ? "\n    " : " ", tab[i]);
+    }
+    fprintf(fp, "\n};\n\n");
+}
+
+static FILE *
+emit_open(const char *base, const char *ext)
+{
+    char path[PATH_MAX];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s%s", base, ext);
+    if ((fp = fopen(path, "w")) == NULL) {
+        perror(path);
+    }
+
+    return fp;
+}
+
+static int
+emit_close(FILE *fp, const char *base)
+{
+    if (fclose(fp) != 0) {
+        perror(base);
+        return -errno;
+    }
+
+    return 0;
+}
+
+/*
+ * Write <base>.S, <base>.c and <base>.h for the image at
+ * @img. Symbols are prefixed with the last component of
+ * @base, anything but letters, digits and '_' made '_'.
+ */
+int
+emit_write(struct omar_emit *emit, const char *base, const char *img)
+{
+    char pfx[64], guard[64], imgpath[PATH_MAX];
+    uint32_t *slots = NULL, *disp = NULL;
+    uint32_t nbuckets, nslots, i;
+    const char *p;
+    FILE *fp;
+    int error;
+
+    if (realpath(img, imgpath) == NULL) {
+        perror(img);
+        return -errno;
+    }
+
+    p = strrchr(base, '/');
+    p = (p == NULL) ? base : p + 1;
+    snprintf(pfx, sizeof(pfx), "%s%s", isdigit((unsigned char)*p) ? "_" : "", p);
+    for (i = 0; pfx[i] != '\0'; ++i) {
+        pfx[i] = isalnum((unsigned char)pfx[i]) ? pfx[i] : '_';
+        guard[i] = toupper((unsigned char)pfx[i]);
+    }
+    guard[i] = '\0';
+
+    /* Grow the table until every bucket finds a place */
+    nbuckets = emit->count / EMIT_BUCKET + 1;
+    nslots = emit->count + emit->count / 4 + 1;
+    for (;;) {
+        slots = malloc(nslots * sizeof(*slots));
+        disp = malloc(nbuckets * sizeof(*disp));
+        if (slots == NULL || disp == NULL) {
+            free(slots);
+            free(disp);
+            fprintf(stderr, "out of memory\n");
+            return -ENOMEM;
+        }
+        if (emit_place(emit, nbuckets, nslots, slots, disp)) {
+            break;
+        }
+        free(slots);
+        free(disp);
+        nslots += nslots / 4 + 1;
+    }
+
+    error = -EIO;
+    if ((fp = emit_open(base, ".S")) == NULL) {
+        goto done;
+    }
+    fprintf(fp, "/* Generated by omar --emit-c, do not edit */\n\n");
+    fprintf(fp, "    .section .rodata\n");
+    fprintf(fp, "    .balign 16\n");
+    fprintf(fp, "    .globl %s_image\n", pfx);
+    fprintf(fp, "    .globl %s_image_end\n", pfx);
+    fprintf(fp, "%s_image:\n", pfx);
+    fprintf(fp, "    .incbin ");
+    emit_str(fp, imgpath);
+    fprintf(fp, "\n%s_image_end:\n", pfx);
+    fprintf(fp, "    .section .note.GNU-stack,\"\",%%progbits\n");
+    if ((error = emit_close(fp, base)) != 0) {
+        goto done;
+    }
+
+    error = -EIO;
+    if ((fp = emit_open(base, ".h")) == NULL) {
+        goto done;
+    }
+    fprintf(fp, "/* Generated by omar --emit-c, do not edit */\n\n");
+    fprintf(fp, "#ifndef %s_H_\n#define %s_H_\n\n", guard, guard);
+    fprintf(fp, "#include <stddef.h>\n#include <stdint.h>\n\n");
+    fprintf(fp, "/*\n * An entry of the image, its data is at\n");
+    fprintf(fp, " * %s_image + off (directories have none)\n */\n", pfx);
+    fprintf(fp, "struct %s_file {\n", pfx);
+    fprintf(fp, "    const char *path;\n");
+    fprintf(fp, "    uint64_t off;\n");
+    fprintf(fp, "    uint64_t size;\n");
+    fprintf(fp, "    uint32_t mode;\n");
+    fprintf(fp, "};\n\n");
+    fprintf(fp, "extern const unsigned char %s_image[];\n", pfx);
+    fprintf(fp, "extern const unsigned char %s_image_end[];\n", pfx);
+    fprintf(fp, "extern const struct %s_file %s_files[];\n", pfx, pfx);
+    fprintf(fp, "extern const size_t %s_nfiles;\n\n", pfx);
+    fprintf(fp, "const struct %s_file *%s_lookup(const char *path);\n\n", pfx, pfx);
+    fprintf(fp, "#endif  /* !%s_H_ */\n", guard);
+    if ((error = emit_close(fp, base)) != 0) {
+        goto done;
+    }
+
+    error = -EIO;
+    if ((fp = emit_open(base, ".c")) == NULL) {
+        goto done;
+    }
+    fprintf(fp, "/* Generated by omar --emit-c, do not edit */\n\n");
+    fprintf(fp, "#include <string.h>\n");
+    fprintf(fp, "#include \"%s.h\"\n\n", p);
+    fprintf(fp, "const size_t %s_nfiles = %zu;\n\n", pfx, emit->count);
+    fprintf(fp, "const struct %s_file %s_files[] = {\n", pfx, pfx);
+    for (i = 0; i < emit->count; ++i) {
+        fprintf(fp, "    { ");
+        emit_str(fp, emit->ents[i].name);
+        fprintf(fp, ", %" PRIu64 ", %" PRIu64 ", 0%o },\n",
+                (uint64_t)emit->ents[i].off, emit->ents[i].size,
+                (unsigned int)emit->ents[i].mode);
+    }
+    fprintf(fp, "    { NULL, 0, 0, 0 }\n};\n\n");
+
+    emit_table(fp, "uint32_t", "disp", disp, nbuckets);
+    emit_table(fp, "uint32_t", "slots", slots, nslots);
+
+    fprintf(fp, "static uint32_t\nhash(const char *s, uint32_t seed)\n{\n");
+    fprintf(fp, "    uint32_t hash = 0x811C9DC5 ^ seed;\n\n");
+    fprintf(fp, "    while (*s != '\\0') {\n");
+    fprintf(fp, "        hash ^= (uint8_t)*s++;\n");
+    fprintf(fp, "        hash *= 0x01000193;\n");
+    fprintf(fp, "    }\n\n");
+    fprintf(fp, "    hash ^= hash >> 16;\n");
+    fprintf(fp, "    hash *= 0x7FEB352D;\n");
+    fprintf(fp, "    hash ^= hash >> 15;\n");
+    fprintf(fp, "    return hash;\n}\n\n");
+
+    fprintf(fp, "const struct %s_file *\n%s_lookup(const char *path)\n{\n", pfx, pfx);
+    fprintf(fp, "    uint32_t d, i;\n\n");
+    fprintf(fp, "    d = disp[hash(path, 0) %% %" PRIu32 "];\n", nbuckets);
+    fprintf(fp, "    i = slots[hash(path, d) %% %" PRIu32 "];\n", nslots);
+    fprintf(fp, "    if (i == 0 || strcmp(%s_files[i - 1].path, path) != 0) {\n", pfx);
+    fprintf(fp, "        return NULL;\n    }\n\n");
+    fprintf(fp, "    return &%s_files[i - 1];\n}\n", pfx);
+    error = emit_close(fp, base);
+done:
+    free(slots);
+    free(disp);
+    return error;
+}
+
+void
+emit_free(struct omar_emit *emit)
+{
+    size_t i;
+
+    for (i = 0; i < emit->count; ++i) {
+        free(emit->ents[i].name);
+    }
+
+    free(emit->ents);
+    emit->ents = NULL;
+    emit->count = 0;
+    emit->cap = 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include "omar.h"
+
+/*
+ * Path filters (--exclude and --include)
+ *
+ * Rules are checked in order and the last one matching a
+ * path decides, like .gitignore. A pattern without a slash
+ * matches the last component of a path, one with a slash
+ * matches the whole path relative to the input directory
+ * (a leading slash only anchors it). A trailing slash limits
+ * the rule to directories. Excluded directories are pruned
+ * before being opened, so nothing below them gets in.
+ */
+
+/*
+ * Add a rule
+ *
+ * @pat: Pattern, see above
+ * @include: True for --include, false for --exclude
+ */
+int
+filter_add(struct omar_filter *filter, const char *pat, bool include)
+{
+    struct omar_rule *rule;
+    size_t len, cap;
+
+    if (filter->count == filter->cap) {
+        cap = (filter->cap == 0) ? 8 : filter->cap * 2;
+        rule = realloc(filter->rules, cap * sizeof(*rule));
+        if (rule == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return -ENOMEM;
+        }
+        filter->rules = rule;
+        filter->cap = cap;
+    }
+
+    rule = &filter->rules[filter->count];
+    memset(rule, 0, sizeof(*rule));
+    rule->include = include;
+
+    len = strlen(pat);
+    if (len > 1 && pat[len - 1] == '/') {
+        rule->dironly = true;
+        --len;
+    }
+    if (memchr(pat, '/', len) != NULL) {
+        rule->fullpath = true;
+    }
+    if (*pat == '/') {
+        ++pat;
+        --len;
+    }
+
+    if ((rule->pat = strndup(pat, len)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+
+    /* Plain names are compared, not matched */
+    rule->literal = strpbrk(rule->pat, "*?[\\") == NULL;
+    ++filter->count;
+    return 0;
+}
+
+/*
+ * Tell whether a path is filtered out
+ *
+ * @path: Pathname relative to the input directory
+ * @isdir: True if @path is a directory
+ */
+bool
+filter_skip(const struct omar_filter *filter, const char *path, bool isdir)
+{
+    const struct omar_rule *rule;
+    const char *base, *s;
+    size_t i;
+
+    if ((base = strrchr(path, '/')) != NULL) {
+        ++base;
+    } else {
+        base = path;
+    }
+
+    for (i = filter->count; i > 0; --i) {
+        rule = &filter->rules[i - 1];
+        if (rule->dironly && !isdir) {
+            continue;
+        }
+
+        s = rule->fullpath ? path : base;
+        if (rule->literal ? strcmp(rule->pat, s) == 0 :
+            fnmatch(rule->pat, s, FNM_PATHNAME) == 0) {
+            return !rule->include;
+        }
+    }
+
+    return false;
+}
+
+void
+filter_free(struct omar_filter *filter)
+{
+    size_t i;
+
+    for (i = 0; i < filter->count; ++i) {
+        free(filter->rules[i].pat);
+    }
+    free(filter->rules);
+    memset(filter, 0, sizeof(*filter));
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "omar.h"
+
+/*
+ * XXH64, a fast non-cryptographic hash used to tell
+ * entry contents apart.
+ */
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t
+read64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t
+xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_P2;
+    acc = ROTL64(acc, 31);
+    return acc * XXH_P1;
+}
+
+static inline uint64_t
+xxh_merge(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+void
+xxh_init(struct omar_xxh *xxh, uint64_t seed)
+{
+    xxh->v[0] = seed + XXH_P1 + XXH_P2;
+    xxh->v[1] = seed + XXH_P2;
+    xxh->v[2] = seed;
+    xxh->v[3] = seed - XXH_P1;
+    xxh->seed = seed;
+    xxh->total = 0;
+    xxh->memlen = 0;
+}
+
+/*
+ * Eat as many 32 byte stripes of @p as possible,
+ * returns the number of bytes consumed.
+ */
+static size_t
+xxh_stripes(struct omar_xxh *xxh, const uint8_t *p, size_t len)
+{
+    uint64_t v0 = xxh->v[0], v1 = xxh->v[1];
+    uint64_t v2 = xxh->v[2], v3 = xxh->v[3];
+    size_t done = 0;
+
+    while (len - done >= 32) {
+        v0 = xxh_round(v0, read64(p + done));
+        v1 = xxh_round(v1, read64(p + done + 8));
+        v2 = xxh_round(v2, read64(p + done + 16));
+        v3 = xxh_round(v3, read64(p + done + 24));
+        done += 32;
+    }
+
+    xxh->v[0] = v0;
+    xxh->v[1] = v1;
+    xxh->v[2] = v2;
+    xxh->v[3] = v3;
+    return done;
+}
+
+void
+xxh_update(struct omar_xxh *xxh, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    size_t n;
+
+    xxh->total += len;
+
+    /* Top off a partial stripe first */
+    if (xxh->memlen > 0) {
+        n = sizeof(xxh->mem) - xxh->memlen;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(xxh->mem + xxh->memlen, p, n);
+        xxh->memlen += n;
+        p += n;
+        len -= n;
+
+        if (xxh->memlen < sizeof(xxh->mem)) {
+            return;
+        }
+        xxh_stripes(xxh, xxh->mem, sizeof(xxh->mem));
+        xxh->memlen = 0;
+    }
+
+    n = xxh_stripes(xxh, p, len);
+    memcpy(xxh->mem, p + n, len - n);
+    xxh->memlen = len - n;
+}
+
+uint64_t
+xxh_final(const struct omar_xxh *xxh)
+{
+    const uint8_t *p = xxh->mem;
+    size_t len = xxh->memlen;
+    uint64_t h;
+
+    if (xxh->total >= 32) {
+        h = ROTL64(xxh->v[0], 1) + ROTL64(xxh->v[1], 7) +
+            ROTL64(xxh->v[2], 12) + ROTL64(xxh->v[3], 18);
+        h = xxh_merge(h, xxh->v[0]);
+        h = xxh_merge(h, xxh->v[1]);
+        h = xxh_merge(h, xxh->v[2]);
+        h = xxh_merge(h, xxh->v[3]);
+    } else {
+        h = xxh->seed + XXH_P5;
+    }
+
+    h += xxh->total;
+    for (; len >= 8; p += 8, len -= 8) {
+        h ^= xxh_round(0, read64(p));
+        h = ROTL64(h, 27) * XXH_P1 + XXH_P4;
+    }
+    if (len >= 4) {
+        h ^= (uint64_t)read32(p) * XXH_P1;
+        h = ROTL64(h, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+        len -= 4;
+    }
+    for (; len > 0; ++p, --len) {
+        h ^= *p * XXH_P5;
+        h = ROTL64(h, 11) * XXH_P1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t
+xxh64(const void *buf, size_t len, uint64_t seed)
+{
+    struct omar_xxh xxh;
+
+    xxh_init(&xxh, seed);
+    xxh_update(&xxh, buf, len);
+    return xxh_final(&xxh);
+}
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include "omar.h"
+
+static inline void
+ls_help(void)
+{
+    printf("Usage: omar ls [archive] [dir]\n");
+}
+
+static void
+ls_print(const struct omar_ent *ent)
+{
+    printf("%s [%c]\n", ent->name, (ent->hdr.type == OMAR_DIR) ? 'd' : 'f');
+}
+
+/*
+ * True if @name is directly under @dir ("" for the top)
+ */
+static bool
+ls_child(const char *name, const char *dir, size_t dirlen)
+{
+    if (dirlen > 0) {
+        if (strncmp(name, dir, dirlen) != 0 || name[dirlen] != '/') {
+            return false;
+        }
+        name += dirlen + 1;
+    }
+
+    return *name != '\0' && strchr(name, '/') == NULL;
+}
+
+/*
+ * List a directory out of the directory section, only
+ * the headers of its children are read. Returns -ENOENT
+ * if the archive has no such section.
+ */
+static int
+ls_dirs(struct omar_ar *ar, const char *dir)
+{
+    struct omar_index idx;
+    struct omar_dirs dirs;
+    struct omar_idxent *ie;
+    struct omar_ent ent;
+    const uint32_t *kids;
+    uint32_t count, i, n;
+    int error;
+
+    if ((error = index_load(ar, &idx)) != 0) {
+        return error;
+    }
+    if ((error = dirs_load(ar, &idx, &dirs)) != 0) {
+        index_free(&idx);
+        return error;
+    }
+
+    n = OMAR_DIR_ROOT;
+    if (*dir != '\0') {
+        if ((ie = index_find(&idx, dir)) == NULL) {
+            fprintf(stderr, "omar: %s: no such directory\n", dir);
+            error = -ENOTDIR;
+            goto done;
+        }
+        n = ie - idx.ents;
+    }
+
+    kids = dirs_find(&dirs, n, &count);
+    for (i = 0; i < count; ++i) {
+        ar->cur = ar->base + idx.ents[kids[i]].off;
+        if ((error = ar_next(ar, &ent)) < 0) {
+            goto done;
+        }
+        if (error > 0) {
+            ls_print(&ent);
+        }
+    }
+    error = 0;
+done:
+    dirs_free(&dirs);
+    index_free(&idx);
+    return error;
+}
+
+int
+ls_main(int argc, char **argv)
+{
+    struct omar_ent ent;
+    struct omar_ar ar;
+    const char *arg = "";
+    char dir[OMAR_PATHMAX];
+    size_t dirlen;
+    bool found;
+    int optc, error;
+
+    while ((optc = getopt(argc, argv, "h")) != -1) {
+        switch (optc) {
+        case 'h':
+            ls_help();
+            return 0;
+        default:
+            ls_help();
+            return -1;
+        }
+    }
+
+    if (argc - optind != 1 && argc - optind != 2) {
+        ls_help();
+        return -1;
+    }
+    if (argc - optind == 2) {
+        arg = argv[optind + 1];
+    }
+
+    /* Same form as the archive paths */
+    while (*arg == '/') {
+        ++arg;
+    }
+    dirlen = snprintf(dir, sizeof(dir), "%s", arg);
+    if (dirlen >= sizeof(dir)) {
+        fprintf(stderr, "omar: %s: path too long\n", arg);
+        return -ENAMETOOLONG;
+    }
+    while (dirlen > 0 && dir[dirlen - 1] == '/') {
+        dir[--dirlen] = '\0';
+    }
+
+    if ((error = ar_open(&ar, argv[optind])) != 0) {
+        return error;
+    }
+
+    /* Most missing directories stop at the Bloom filter */
+    if (dirlen > 0 && bloom_check(&ar, dir) == 0) {
+        fprintf(stderr, "omar: %s: no such directory\n", dir);
+        ar_close(&ar);
+        return -ENOTDIR;
+    }
+
+    /* Without a directory section every header is compared */
+    if ((error = ls_dirs(&ar, dir)) == -ENOENT) {
+        found = (dirlen == 0);
+        ar.cur = ar.base;
+        while ((error = ar_next(&ar, &ent)) > 0) {
+            if (ls_child(ent.name, dir, dirlen)) {
+                ls_print(&ent);
+            }
+            found |= (dirlen > 0 && strcmp(ent.name, dir) == 0);
+        }
+        if (error == 0 && !found) {
+            fprintf(stderr, "omar: %s: no such directory\n", dir);
+            error = -ENOTDIR;
+        }
+    }
+
+    ar_close(&ar);
+    return error;
+}
@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <inttypes.h>
+#include "omar.h"
+
+/*
+ * A manifest lists the SHA-256 and XXH64 of every file in
+ * an archive. The hashes are taken over the very bytes
+ * that go into the archive: files are copied through
+ * buffers of a fixed pool (manifest_copy()) and each
+ * buffer, once written out, is handed to the workers,
+ * which hash it while the main thread reads the next one.
+ * The blocks of a file are hashed in order by one worker
+ * at a time, different files by different workers.
+ */
+
+/* Buffers in flight between the copy and the workers */
+#define MANIFEST_QUEUE  64
+
+/* Size of each buffer */
+#define MANIFEST_BUFSZ  (1 << 18)
+
+/*
+ * A buffer of file data waiting to be hashed
+ */
+struct omar_mfblk {
+    struct omar_mfblk *next;
+    size_t len;
+    char data[MANIFEST_BUFSZ];
+};
+
+/*
+ * Put an entry on the run queue unless a worker
+ * already has it, with the lock held.
+ */
+static void
+manifest_run(struct omar_manifest *mf, struct omar_mfent *ent)
+{
+    if (ent->busy) {
+        return;
+    }
+
+    ent->busy = true;
+    ent->next = NULL;
+    if (mf->runtail != NULL) {
+        mf->runtail->next = ent;
+    } else {
+        mf->runq = ent;
+    }
+    mf->runtail = ent;
+    pthread_cond_signal(&mf->more);
+}
+
+static void *
+manifest_worker(void *p)
+{
+    struct omar_manifest *mf = p;
+    struct omar_mfent *ent;
+    struct omar_mfblk *blk;
+
+    pthread_mutex_lock(&mf->lock);
+    for (;;) {
+        while (mf->runq == NULL && !mf->done) {
+            pthread_cond_wait(&mf->more, &mf->lock);
+        }
+        if ((ent = mf->runq) == NULL) {
+            break;
+        }
+        if ((mf->runq = ent->next) == NULL) {
+            mf->runtail = NULL;
+        }
+
+        /* Nobody else touches @ent while it is busy */
+        while ((blk = ent->head) != NULL) {
+            if ((ent->head = blk->next) == NULL) {
+                ent->tail = NULL;
+            }
+            pthread_mutex_unlock(&mf->lock);
+            sha256_update(&ent->shactx, blk->data, blk->len);
+            xxh_update(&ent->xxhctx, blk->data, blk->len);
+            pthread_mutex_lock(&mf->lock);
+
+            blk->next = mf->free;
+            mf->free = blk;
+            pthread_cond_signal(&mf->room);
+        }
+
+        if (ent->ended && !ent->hashed) {
+            sha256_final(&ent->shactx, ent->sha);
+            ent->xxh = xxh_final(&ent->xxhctx);
+            ent->hashed = true;
+        }
+        ent->busy = false;
+    }
+    pthread_mutex_unlock(&mf->lock);
+    return NULL;
+}
+
+/*
+ * Start the hashing workers, all but one CPU are
+ * left to them.
+ */
+int
+manifest_open(struct omar_manifest *mf)
+{
+    size_t i;
+
+    memset(mf, 0, sizeof(*mf));
+    pthread_mutex_init(&mf->lock, NULL);
+    pthread_cond_init(&mf->more, NULL);
+    pthread_cond_init(&mf->room, NULL);
+
+    mf->ntd = par_threads();
+    mf->ntd = (mf->ntd > 1) ? mf->ntd - 1 : 1;
+    if ((mf->td = malloc(mf->ntd * sizeof(*mf->td))) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < mf->ntd; ++i) {
+        if (pthread_create(&mf->td[i], NULL, manifest_worker, mf) != 0) {
+            break;
+        }
+    }
+    if ((mf->ntd = i) == 0) {
+        fprintf(stderr, "omar: failed to start manifest workers\n");
+        free(mf->td);
+        return -EAGAIN;
+    }
+
+    return 0;
+}
+
+/*
+ * Add an entry for @name in archive order
+ */
+static int
+manifest_add(struct omar_manifest *mf, const char *name,
+             struct omar_mfent **res)
+{
+    struct omar_mfent *ent, **p;
+
+    if ((ent = calloc(1, sizeof(*ent))) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+    if ((ent->name = strdup(name)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        free(ent);
+        return -ENOMEM;
+    }
+    sha256_init(&ent->shactx);
+    xxh_init(&ent->xxhctx, 0);
+
+    pthread_mutex_lock(&mf->lock);
+    if (mf->count == mf->cap) {
+        mf->cap = (mf->cap == 0) ? 256 : mf->cap * 2;
+        if ((p = realloc(mf->ents, mf->cap * sizeof(*p))) == NULL) {
+            pthread_mutex_unlock(&mf->lock);
+            fprintf(stderr, "out of memory\n");
+            free(ent->name);
+            free(ent);
+            return -ENOMEM;
+        }
+        mf->ents = p;
+    }
+    mf->ents[mf->count++] = ent;
+    pthread_mutex_unlock(&mf->lock);
+
+    *res = ent;
+    return 0;
+}
+
+/*
+ * Take a free buffer, waiting for the workers
+ * once the pool is used up.
+ */
+static struct omar_mfblk *
+manifest_blk(struct omar_manifest *mf)
+{
+    struct omar_mfblk *blk;
+
+    pthread_mutex_lock(&mf->lock);
+    while (mf->free == NULL && mf->nblk == MANIFEST_QUEUE) {
+        pthread_cond_wait(&mf->room, &mf->lock);
+    }
+    if ((blk = mf->free) != NULL) {
+        mf->free = blk->next;
+    } else if ((blk = malloc(sizeof(*blk))) != NULL) {
+        ++mf->nblk;
+    }
+    pthread_mutex_unlock(&mf->lock);
+    return blk;
+}
+
+/*
+ * Hand a filled buffer over to the workers, or put
+ * it back if @ent is NULL.
+ */
+static void
+manifest_queue(struct omar_manifest *mf, struct omar_mfent *ent,
+               struct omar_mfblk *blk)
+{
+    pthread_mutex_lock(&mf->lock);
+    if (ent == NULL) {
+        blk->next = mf->free;
+        mf->free = blk;
+    } else {
+        blk->next = NULL;
+        if (ent->tail != NULL) {
+            ent->tail->next = blk;
+        } else {
+            ent->head = blk;
+        }
+        ent->tail = blk;
+        manifest_run(mf, ent);
+    }
+    pthread_mutex_unlock(&mf->lock);
+}
+
+/*
+ * All the data of @ent was queued
+ */
+static void
+manifest_end(struct omar_manifest *mf, struct omar_mfent *ent)
+{
+    pthread_mutex_lock(&mf->lock);
+    ent->ended = true;
+    manifest_run(mf, ent);
+    pthread_mutex_unlock(&mf->lock);
+}
+
+/*
+ * Copy @len bytes of @fd to the output, hashing them
+ * on the way for the manifest entry of @name.
+ */
+int
+manifest_copy(struct omar_manifest *mf, const char *name,
+              struct omar_out *out, int fd, uint64_t len)
+{
+    struct omar_mfent *ent;
+    struct omar_mfblk *blk;
+    uint64_t off = 0;
+    int error;
+
+    if ((error = manifest_add(mf, name, &ent)) != 0) {
+        return error;
+    }
+
+    while (off < len) {
+        if ((blk = manifest_blk(mf)) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            error = -ENOMEM;
+            break;
+        }
+
+        blk->len = (len - off < MANIFEST_BUFSZ) ? len - off : MANIFEST_BUFSZ;
+        error = pread_all(fd, blk->data, blk->len, off);
+        if (error == 0) {
+            error = out_write(out, blk->data, blk->len);
+        }
+        if (error != 0) {
+            manifest_queue(mf, NULL, blk);
+            break;
+        }
+
+        off += blk->len;
+        manifest_queue(mf, ent, blk);
+    }
+
+    manifest_end(mf, ent);
+    return error;
+}
+
+/*
+ * Hash @len bytes at @buf for the manifest entry of
+ * @name, for data that is in memory already.
+ */
+int
+manifest_data(struct omar_manifest *mf, const char *name, const void *buf,
+              uint64_t len)
+{
+    struct omar_mfent *ent;
+    struct omar_mfblk *blk;
+    const char *p = buf;
+    int error;
+
+    if ((error = manifest_add(mf, name, &ent)) != 0) {
+        return error;
+    }
+
+    while (len > 0) {
+        if ((blk = manifest_blk(mf)) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            error = -ENOMEM;
+            break;
+        }
+
+        blk->len = (len < MANIFEST_BUFSZ) ? len : MANIFEST_BUFSZ;
+        memcpy(blk->data, p, blk->len);
+        manifest_queue(mf, ent, blk);
+        p += blk->len;
+        len -= blk->len;
+    }
+
+    manifest_end(mf, ent);
+    return error;
+}
+
+/*
+ * Add the manifest entry of @name with digests known
+ * already (build cache hits).
+ */
+int
+manifest_put(struct omar_manifest *mf, const char *name,
+             const uint8_t sha[32], uint64_t xxh)
+{
+    struct omar_mfent *ent;
+    int error;
+
+    if ((error = manifest_add(mf, name, &ent)) != 0) {
+        return error;
+    }
+
+    pthread_mutex_lock(&mf->lock);
+    memcpy(ent->sha, sha, sizeof(ent->sha));
+    ent->xxh = xxh;
+    ent->ended = true;
+    ent->hashed = true;
+    pthread_mutex_unlock(&mf->lock);
+    return 0;
+}
+
+/*
+ * Wait for the workers and write out the manifest, one
+ * "<sha256> <xxh64> <path>" line per file in archive
+ * order. A NULL @path only releases everything.
+ */
+int
+manifest_close(struct omar_manifest *mf, const char *path)
+{
+    struct omar_mfent *ent;
+    struct omar_mfblk *blk;
+    FILE *fp = NULL;
+    int error = 0;
+    size_t i, j;
+
+    pthread_mutex_lock(&mf->lock);
+    mf->done = true;
+    pthread_cond_broadcast(&mf->more);
+    pthread_mutex_unlock(&mf->lock);
+    for (i = 0; i < mf->ntd; ++i) {
+        pthread_join(mf->td[i], NULL);
+    }
+
+    if (path != NULL && (fp = fopen(path, "w")) == NULL) {
+        perror(path);
+        error = -errno;
+    }
+
+    for (i = 0; i < mf->count; ++i) {
+        ent = mf->ents[i];
+        if (!ent->hashed && error == 0 && fp != NULL) {
+            fprintf(stderr, "omar: %s: not hashed\n", ent->name);
+            error = -EIO;
+        }
+        if (fp != NULL && error == 0) {
+            for (j = 0; j < sizeof(ent->sha); ++j) {
+                fprintf(fp, "%02x", ent->sha[j]);
+            }
+            fprintf(fp, " %016" PRIx64 " %s\n", ent->xxh, ent->name);
+        }
+        while ((blk = ent->head) != NULL) {
+            ent->head = blk->next;
+            free(blk);
+        }
+        free(ent->name);
+        free(ent);
+    }
+
+    if (fp != NULL && fclose(fp) != 0 && error == 0) {
+        perror(path);
+        error = -errno;
+    }
+
+    while ((blk = mf->free) != NULL) {
+        mf->free = blk->next;
+        free(blk);
+    }
+
+    pthread_mutex_destroy(&mf->lock);
+    pthread_cond_destroy(&mf->more);
+    pthread_cond_destroy(&mf->room);
+    free(mf->ents);
+    free(mf->td);
+    return error;
+}
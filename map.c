@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "omar.h"
+
+#define MAP_MINCAP 64
+
+/*
+ * FNV-1a hash of a string
+ */
+uint64_t
+hash_str(const char *s)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    while (*s != '\0') {
+        hash ^= (uint8_t)*s++;
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+/*
+ * Find the slot for @key, which is either the slot
+ * holding it or the empty slot it would go into.
+ */
+static struct omar_mapent *
+map_slot(struct omar_mapent *tab, size_t cap, const char *key, uint64_t hash)
+{
+    struct omar_mapent *ent;
+    size_t i;
+
+    i = hash & (cap - 1);
+    for (;;) {
+        ent = &tab[i];
+        if (ent->key == NULL) {
+            return ent;
+        }
+        if (ent->hash == hash && strcmp(ent->key, key) == 0) {
+            return ent;
+        }
+        i = (i + 1) & (cap - 1);
+    }
+}
+
+/*
+ * Double the size of the table
+ */
+static int
+map_grow(struct omar_map *map)
+{
+    struct omar_mapent *tab, *ent;
+    size_t cap, i;
+
+    cap = (map->cap == 0) ? MAP_MINCAP : map->cap * 2;
+    tab = calloc(cap, sizeof(*tab));
+    if (tab == NULL) {
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < map->cap; ++i) {
+        if (map->tab[i].key == NULL) {
+            continue;
+        }
+        ent = map_slot(tab, cap, map->tab[i].key, map->tab[i].hash);
+        *ent = map->tab[i];
+    }
+
+    free(map->tab);
+    map->tab = tab;
+    map->cap = cap;
+    return 0;
+}
+
+/*
+ * Look up @key, returns a pointer to its value
+ * or NULL if not present.
+ */
+void **
+map_get(struct omar_map *map, const char *key)
+{
+    struct omar_mapent *ent;
+
+    if (map->count == 0) {
+        return NULL;
+    }
+
+    ent = map_slot(map->tab, map->cap, key, hash_str(key));
+    return (ent->key == NULL) ? NULL : &ent->val;
+}
+
+/*
+ * Look up @key, inserting it with a NULL value if
+ * not present. Returns a pointer to the value or
+ * NULL if we ran out of memory.
+ */
+void **
+map_put(struct omar_map *map, const char *key)
+{
+    struct omar_mapent *ent;
+    uint64_t hash;
+
+    if ((map->count + 1) * 2 > map->cap && map_grow(map) != 0) {
+        return NULL;
+    }
+
+    hash = hash_str(key);
+    ent = map_slot(map->tab, map->cap, key, hash);
+    if (ent->key != NULL) {
+        return &ent->val;
+    }
+
+    if ((ent->key = strdup(key)) == NULL) {
+        return NULL;
+    }
+
+    ent->hash = hash;
+    ent->val = NULL;
+    ++map->count;
+    return &ent->val;
+}
+
+void
+map_free(struct omar_map *map, bool free_vals)
+{
+    size_t i;
+
+    for (i = 0; i < map->cap; ++i) {
+        free(map->tab[i].key);
+        if (free_vals) {
+            free(map->tab[i].val);
+        }
+    }
+
+    free(map->tab);
+    memset(map, 0, sizeof(*map));
+}
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include "omar.h"
+
+/* Duplicate path policies */
+#define DUP_FIRST   0
+#define DUP_LAST    1
+#define DUP_ERROR   2
+
+/*
+ * The entry that ends up in the merged archive
+ * for a given path.
+ *
+ * @idx: Index of the input archive
+ * @off: Header offset within that archive
+ * @type: Entry type
+ */
+struct merge_src {
+    int idx;
+    off_t off;
+    uint8_t type;
+};
+
+static inline void
+merge_help(void)
+{
+    printf("Usage: omar merge [-I] [-p policy] -o [output] [archive...]\n");
+    printf("       omar stitch [-p policy] -o [output] [part...]\n");
+    printf("-I      Write an index\n");
+    printf("-p      Duplicate path policy (first, last, error)\n");
+}
+
+/*
+ * Decide which entry wins for each path. Nothing but
+ * headers are read here.
+ */
+static int
+merge_scan(struct omar_ar *ar, int nar, int policy, struct omar_map *map)
+{
+    struct omar_ent ent;
+    struct merge_src *src;
+    void **slot;
+    int i, error;
+
+    for (i = 0; i < nar; ++i) {
+        while ((error = ar_next(&ar[i], &ent)) > 0) {
+            if ((slot = map_put(map, ent.name)) == NULL) {
+                fprintf(stderr, "out of memory\n");
+                return -ENOMEM;
+            }
+
+            if ((src = *slot) == NULL) {
+                if ((src = malloc(sizeof(*src))) == NULL) {
+                    fprintf(stderr, "out of memory\n");
+                    return -ENOMEM;
+                }
+                src->idx = i;
+                src->off = ent.off;
+                src->type = ent.hdr.type;
+                *slot = src;
+                continue;
+            }
+
+            /*
+             * Directories are the same no matter where they come
+             * from, keep the first so it precedes its children.
+             */
+            if (src->type == OMAR_DIR && ent.hdr.type == OMAR_DIR) {
+                continue;
+            }
+
+            switch (policy) {
+            case DUP_FIRST:
+                break;
+            case DUP_LAST:
+                src->idx = i;
+                src->off = ent.off;
+                src->type = ent.hdr.type;
+                break;
+            case DUP_ERROR:
+                fprintf(stderr, "omar: %s: duplicate path\n", ent.name);
+                return -EEXIST;
+            }
+        }
+
+        if (error < 0) {
+            return error;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Copy out the winning entries. Runs of adjacent entries
+ * are coalesced so the kernel sees as few copies as
+ * possible.
+ */
+static int
+merge_copy(struct omar_ar *ar, int nar, struct omar_map *map,
+           struct omar_out *out, struct omar_index *idx)
+{
+    struct omar_ent ent;
+    struct merge_src *src;
+    off_t runoff, runlen;
+    int i, error;
+
+    for (i = 0; i < nar; ++i) {
+        ar_rewind(&ar[i]);
+        runoff = 0;
+        runlen = 0;
+
+        while ((error = ar_next(&ar[i], &ent)) > 0) {
+            src = *map_get(map, ent.name);
+            if (src->idx != i || src->off != ent.off) {
+                continue;
+            }
+
+            /* Chunk and parent offsets don't survive the move, expand those */
+            if (ent.hdr.type == OMAR_CHUNKED || ent.hdr.rev == OMAR_REV_REL) {
+                error = 0;
+                if (runlen > 0) {
+                    error = out_copy(out, ar[i].fd, runoff, runlen);
+                    runlen = 0;
+                }
+                if (error == 0 && idx != NULL) {
+                    error = index_add(idx, ent.name, out->off);
+                }
+                if (error == 0) {
+                    error = ar_expand(&ar[i], &ent, out);
+                }
+                if (error != 0) {
+                    return error;
+                }
+                continue;
+            }
+
+            if (runlen > 0 && runoff + runlen != ent.off) {
+                error = out_copy(out, ar[i].fd, runoff, runlen);
+                if (error != 0) {
+                    return error;
+                }
+                runlen = 0;
+            }
+            if (runlen == 0) {
+                runoff = ent.off;
+            }
+
+            /* The pending run lands at the current output offset */
+            if (idx != NULL && index_add(idx, ent.name, out->off + runlen) != 0) {
+                return -ENOMEM;
+            }
+            runlen += ent.span;
+        }
+
+        if (error < 0) {
+            return error;
+        }
+        if (runlen > 0 && (error = out_copy(out, ar[i].fd, runoff, runlen)) != 0) {
+            return error;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * omar merge [-I] [-p policy] -o output archive...
+ * omar stitch [-p policy] -o output part...
+ *
+ * Stitching is a merge of partial archives built with
+ * --shard, which by default refuses duplicate files
+ * and always writes an index.
+ */
+static int
+merge(int argc, char **argv, bool stitch)
+{
+    struct omar_index index = {0};
+    struct omar_map map = {0};
+    struct omar_out out;
+    struct omar_ar *ar;
+    const char *outpath = NULL;
+    int policy = stitch ? DUP_ERROR : DUP_FIRST;
+    bool want_index = stitch;
+    int optc, nar, i, fd;
+    int error = 0;
+
+    while ((optc = getopt(argc, argv, "hIp:o:")) != -1) {
+        switch (optc) {
+        case 'I':
+            want_index = true;
+            break;
+        case 'p':
+            if (strcmp(optarg, "first") == 0) {
+                policy = DUP_FIRST;
+            } else if (strcmp(optarg, "last") == 0) {
+                policy = DUP_LAST;
+            } else if (strcmp(optarg, "error") == 0) {
+                policy = DUP_ERROR;
+            } else {
+                fprintf(stderr, "omar: bad policy \"%s\"\n", optarg);
+                return -1;
+            }
+            break;
+        case 'o':
+            outpath = optarg;
+            break;
+        case 'h':
+            merge_help();
+            return 0;
+        default:
+            merge_help();
+            return -1;
+        }
+    }
+
+    if (outpath == NULL) {
+        fprintf(stderr, "omar: no output path\n");
+        merge_help();
+        return -1;
+    }
+
+    nar = argc - optind;
+    if (nar < 1) {
+        fprintf(stderr, "omar: no input archives\n");
+        merge_help();
+        return -1;
+    }
+
+    ar = calloc(nar, sizeof(*ar));
+    if (ar == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < nar; ++i) {
+        if ((error = ar_open(&ar[i], argv[optind + i])) != 0) {
+            nar = i;
+            goto done;
+        }
+    }
+
+    if ((error = merge_scan(ar, nar, policy, &map)) != 0) {
+        goto done;
+    }
+
+    fd = open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0700);
+    if (fd < 0) {
+        printf("omar: failed to open output file\n");
+        error = fd;
+        goto done;
+    }
+
+    if ((error = out_init(&out, fd)) == 0) {
+        error = merge_copy(ar, nar, &map, &out, want_index ? &index : NULL);
+        if (error == 0) {
+            error = out_finish(&out, 0, want_index ? &index : NULL);
+        }
+        out_fini(&out);
+    }
+    if (error != 0) {
+        fprintf(stderr, "omar: %s failed: %s\n", argv[0], strerror(-error));
+    }
+    close(fd);
+done:
+    for (i = 0; i < nar; ++i) {
+        ar_close(&ar[i]);
+    }
+    map_free(&map, true);
+    index_free(&index);
+    free(ar);
+    return error;
+}
+
+int
+merge_main(int argc, char **argv)
+{
+    return merge(argc, argv, false);
+}
+
+int
+stitch_main(int argc, char **argv)
+{
+    return merge(argc, argv, true);
+}
@@ -29,6 +29,9 @@
 
 #include <sys/stat.h>
 #include <sys/errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fiemap.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <stdbool.h>
@@ -39,298 +42,1521 @@
 #include <assert.h>
 #include <dirent.h>
 #include <string.h>
-#include <libgen.h>
+#include <limits.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include "omar.h"
 
-/* OMAR magic constants */
-#define OMAR_MAGIC "OMAR"
-#define OMAR_EOF "RAMO"
-
-/* OMAR type constants */
-#define OMAR_REG    0
-#define OMAR_DIR    1
+/* From <linux/fs.h>, whose BLOCK_SIZE clashes with ours */
+#ifndef FS_IOC_FIEMAP
+#define FS_IOC_FIEMAP _IOWR('f', 11, struct fiemap)
+#endif
 
 /* OMAR modes */
 #define OMAR_ARCHIVE  0
 #define OMAR_EXTRACT  1
 
-/* Revision */
-#define OMAR_REV 2
-
-#define ALIGN_UP(value, align)        (((value) + (align)-1) & ~((align)-1))
-#define BLOCK_SIZE 512
+#define NELEM(a) (sizeof(a) / sizeof((a)[0]))
 
 static int mode = OMAR_ARCHIVE;
 static int outfd;
 static const char *inpath = NULL;
 static const char *outpath = NULL;
 static const char *mbrpath = NULL;
+static const char *cachepath = NULL;
+static bool show_stats = false;
+static bool chunking = false;
+static bool want_index = false;
+static bool planning = false;
+static bool drop_cache = false;
+static const char *manifestpath = NULL;
+static struct omar_manifest manifest;
+static const char *emitpath = NULL;
+static bool relnames = false;
+static struct omar_emit emit;
+
+/* Extraction durability (--sync) */
+#define SYNC_NONE   0
+#define SYNC_FS     1   /* One syncfs() at the end */
+#define SYNC_FILE   2   /* Every file and directory */
+
+/* Files whose writeback is waited on together */
+#define SYNC_BATCH  64
+
+static int sync_mode = SYNC_NONE;
+
+/* Extract over an existing tree (--update) */
+static bool updating = false;
+
+/*
+ * Mtime given to extracted files, that of the archive. A
+ * file of the right size that has it was left by an
+ * extraction of this very archive, so --update keeps it
+ * without reading it.
+ */
+static struct timespec stamp;
+
+/* Hot set first extraction (--hot) */
+static const char *hotpath = NULL;
+static const char *readypath = NULL;
+static int notifyfd = -1;
+
+/* Where created paths are listed */
+static FILE *listfp;
+static struct omar_map hotset;
+
+/* extract_pass() passes */
+#define EXTRACT_ALL     0
+#define EXTRACT_HOT     1   /* Directories and the hot set */
+#define EXTRACT_COLD    2   /* All the rest */
+
+/* From <linux/ioprio.h> */
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_WHO_PROCESS  1
+#define IOPRIO_PRIO_VALUE(class, data) (((class) << 13) | (data))
+
+/* Compare buffer of --update */
+#define UPDATE_BUFSZ (1 << 16)
+static uint32_t shard, nshards;
+static off_t base;
+static struct omar_out out;
+static struct omar_cache cache;
+static struct omar_cdc cdc;
+static struct omar_index pathidx;
+static struct omar_filter filter;
+
+/* Most input roots (-i) taken */
+#define MAX_ROOTS 32
 
 /*
- * The OMAR file header, describes the basics
- * of a file.
+ * Input roots (-i root[:prefix])
  *
- * @magic: Header magic ("OMAR")
- * @len: Length of the file
- * @namelen: Length of the filename
- * @rev: OMAR revision
- * @mode: File permissions
- */
-struct omar_hdr {
-    char magic[4];
-    uint8_t type;
-    uint8_t namelen;
-    uint32_t len;
-    uint8_t rev;
-    uint32_t mode;
-} __attribute__((packed));
+ * @path: Directory to archive
+ * @prefix: Where its contents go in the archive ("" for the top)
+ * @arg: Copy of the argument, split up by roots_split()
+ */
+static struct {
+    const char *path;
+    const char *prefix;
+    char arg[PATH_MAX];
+} roots[MAX_ROOTS];
+static size_t nroots;
+
+/*
+ * Archive creation and extraction statistics (--stats)
+ */
+static struct {
+    uint64_t files;
+    uint64_t dirs;
+    uint64_t bytes;
+    uint64_t pad;
+    uint64_t extents;
+    uint64_t maxext;
+    uint64_t kept;
+} stats;
+
+/* Long only options */
+#define OPT_CACHE   256
+#define OPT_STATS   257
+#define OPT_CHUNK   258
+#define OPT_INDEX   259
+#define OPT_SHARD   260
+#define OPT_PLAN    261
+#define OPT_EXCLUDE 262
+#define OPT_INCLUDE 263
+#define OPT_DROP    264
+#define OPT_SYNC    265
+#define OPT_UPDATE  266
+#define OPT_HOT     267
+#define OPT_READY   268
+#define OPT_NOTIFY  269
+#define OPT_MANIFEST 270
+#define OPT_EMIT    271
+#define OPT_DIRS    272
+#define OPT_RELNAMES 273
+#define OPT_BLOOM   274
+
+static const struct option longopts[] = {
+    { "cache", required_argument, NULL, OPT_CACHE },
+    { "stats", no_argument, NULL, OPT_STATS },
+    { "chunk", no_argument, NULL, OPT_CHUNK },
+    { "index", no_argument, NULL, OPT_INDEX },
+    { "shard", required_argument, NULL, OPT_SHARD },
+    { "plan", no_argument, NULL, OPT_PLAN },
+    { "exclude", required_argument, NULL, OPT_EXCLUDE },
+    { "include", required_argument, NULL, OPT_INCLUDE },
+    { "drop-cache", no_argument, NULL, OPT_DROP },
+    { "sync", required_argument, NULL, OPT_SYNC },
+    { "update", no_argument, NULL, OPT_UPDATE },
+    { "hot", required_argument, NULL, OPT_HOT },
+    { "ready", required_argument, NULL, OPT_READY },
+    { "notify-fd", required_argument, NULL, OPT_NOTIFY },
+    { "manifest", required_argument, NULL, OPT_MANIFEST },
+    { "emit-c", required_argument, NULL, OPT_EMIT },
+    { "dirs", no_argument, NULL, OPT_DIRS },
+    { "relative-names", no_argument, NULL, OPT_RELNAMES },
+    { "bloom", no_argument, NULL, OPT_BLOOM },
+    { NULL, 0, NULL, 0 }
+};
+
+/*
+ * Subcommands, given as the first argument
+ */
+static const struct {
+    const char *name;
+    int(*main)(int argc, char **argv);
+} cmdtab[] = {
+    { "merge", merge_main },
+    { "diff", diff_main },
+    { "patch", patch_main },
+    { "update", update_main },
+    { "stitch", stitch_main },
+    { "analyze", analyze_main },
+    { "cmp", cmp_main },
+    { "cat", cat_main },
+    { "convert", convert_main },
+    { "ls", ls_main },
+};
 
 static inline void
 help(void)
 {
     printf("--------------------------------------\n");
     printf("The OSMORA archive format\n");
-    printf("Usage: omar -i [input_dir] -o [output]\n");
+    printf("Usage: omar -i [input_dir[:prefix]]... -o [output]\n");
+    printf("       omar merge [-p policy] -o [output] [archive...]\n");
+    printf("       omar diff [old] [new] > [patch]\n");
+    printf("       omar patch [-c] [old] [patch] > [new]\n");
+    printf("       omar update [archive] [path=source...]\n");
+    printf("       omar stitch [-p policy] -o [output] [part...]\n");
+    printf("       omar analyze [archive]\n");
+    printf("       omar cmp [-c] [archive] [archive]\n");
+    printf("       omar cat [archive] [path]\n");
+    printf("       omar convert [-I] -o [output] < [cpio or tar]\n");
+    printf("       omar ls [archive] [dir]\n");
     printf("-h      Show this help screen\n");
     printf("-x      Extract an OMAR archive\n");
     printf("-m      Stick an MBR image at the start\n");
+    printf("--cache [dir]   Reuse file data from a build cache\n");
+    printf("--stats         Print statistics when done\n");
+    printf("--chunk         Deduplicate large files by chunks\n");
+    printf("--index         Write an index of all paths\n");
+    printf("--dirs          Write an index and the children of each directory\n");
+    printf("--relative-names Store names relative to their parent (rev 3)\n");
+    printf("--bloom         Write an index and a Bloom filter of all paths\n");
+    printf("--shard [k/n]   Build shard k of n as a partial archive\n");
+    printf("--manifest [f]  Write the SHA-256 and XXH64 of each file to f\n");
+    printf("--emit-c [base] Write base.S, base.c and base.h to link the image in\n");
+    printf("--plan          Print the image size without writing it\n");
+    printf("--exclude [pat] Leave out matching paths (default: .*)\n");
+    printf("--include [pat] Keep matching paths despite --exclude\n");
+    printf("--drop-cache    Keep inputs and outputs out of the page cache\n");
+    printf("--sync [mode]   Extract durably: none, fs or file\n");
+    printf("--update        Extract over a tree, rewriting changed files only\n");
+    printf("--hot [list]    Extract the listed paths first\n");
+    printf("--ready [path]  Create a file once the hot set is out\n");
+    printf("--notify-fd [n] Write READY=1 to fd n once the hot set is out\n");
     printf("--------------------------------------\n");
 }
 
 /*
- * Strip out root dir
- *
- * XXX: This is added code to work with Hyra
- *      initramfs.
+ * Recursive mkdir
  */
-static const char *
-strip_root(const char *path)
+static void
+mkpath(struct omar_hdr *hdr, const char *path)
 {
-    const char *p;
+    size_t len;
+    char buf[PATH_MAX];
+    char cwd[256];
+    char *p = NULL;
 
-    for (p = path; *p != '\0'; ++p) {
+    len = snprintf(buf, sizeof(buf), "%s", path);
+    if (buf[len - 1] == '/') {
+        buf[len - 1] = '\0';
+    }
+    for (p = (char *)buf + 1; *p != '\0'; ++p) {
         if (*p == '/') {
-            ++p;
-            return p;
+            *p = '\0';
+            mkdir(buf, hdr->mode);
+            *p = '/';
         }
     }
 
-    return NULL;
+    mkdir(buf, hdr->mode);
 }
 
 /*
- * Recursive mkdir
+ * Done reading a file, with --drop-cache
+ * its pages are of no more use.
+ */
+static void
+input_done(int fd)
+{
+    if (drop_cache) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    close(fd);
+}
+
+/*
+ * Extracted files waiting for their data to hit the disk
+ * (--sync file), their writeback is already under way.
+ * Files replacing others (--update) are still at @tmp and
+ * only renamed to @path once durable.
+ */
+struct sync_file {
+    int fd;
+    char *tmp;
+    char *path;
+};
+
+static struct sync_file syncfds[SYNC_BATCH];
+static size_t nsyncfds;
+
+/* Directories to be synced once done (--sync file) */
+static char **syncdirs;
+static size_t nsyncdirs;
+
+/*
+ * Wait for the writeback of the batched files and make
+ * them durable. Their data was written back together so
+ * each fdatasync() only has the metadata left to commit.
+ */
+static int
+sync_batch(void)
+{
+    struct sync_file *sf;
+    size_t i;
+    int synced, error = 0;
+
+    for (i = 0; i < nsyncfds; ++i) {
+        sf = &syncfds[i];
+        sync_file_range(sf->fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE |
+                        SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        if ((synced = fdatasync(sf->fd)) != 0 && error == 0) {
+            perror("fdatasync");
+            error = -errno;
+        }
+        if (drop_cache) {
+            posix_fadvise(sf->fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+        close(sf->fd);
+
+        /* A replaced file must be durable before it is renamed */
+        if (sf->tmp == NULL) {
+            continue;
+        }
+        if (synced == 0 && rename(sf->tmp, sf->path) != 0) {
+            perror(sf->path);
+            synced = -1;
+            if (error == 0) {
+                error = -errno;
+            }
+        }
+        if (synced != 0) {
+            unlink(sf->tmp);
+        }
+        free(sf->tmp);
+        free(sf->path);
+    }
+
+    nsyncfds = 0;
+    return error;
+}
+
+/*
+ * Create an extracted file with all of its blocks
+ * reserved up front, so the filesystem can lay it
+ * out in as few extents as possible. With --update
+ * the file is written next to its final path, see
+ * output_commit().
+ *
+ * @size: Final file size
+ * @tmp: Buffer of PATH_MAX bytes for the temporary path
+ */
+static int
+output_open(const char *path, mode_t mode, uint64_t size, char *tmp)
+{
+    int fd;
+
+    tmp[0] = '\0';
+    if (updating) {
+        snprintf(tmp, PATH_MAX, "%s.omarXXXXXX", path);
+        if ((fd = mkstemp(tmp)) < 0 || fchmod(fd, mode & 07777) != 0) {
+            perror(tmp);
+            if (fd >= 0) {
+                close(fd);
+                unlink(tmp);
+            }
+            return -errno;
+        }
+    } else if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode)) < 0) {
+        perror(path);
+        return -errno;
+    }
+
+    if (size > 0 && fallocate(fd, 0, 0, size) != 0 &&
+        errno != EOPNOTSUPP && errno != ENOSYS) {
+        perror(path);
+        close(fd);
+        if (tmp[0] != '\0') {
+            unlink(tmp);
+        }
+        return -errno;
+    }
+
+    return fd;
+}
+
+/*
+ * Put a file written by output_open() in place, replacing
+ * whatever was there in one step (--update). Files handed
+ * to the sync batch by output_close() are left to it.
+ */
+static int
+output_commit(const char *path, const char *tmp, int error)
+{
+    if (tmp[0] == '\0') {
+        return error;
+    }
+
+    if (error == 0 && rename(tmp, path) != 0) {
+        perror(path);
+        error = -errno;
+    }
+    if (error != 0) {
+        unlink(tmp);
+    }
+
+    return error;
+}
+
+/*
+ * See if the file at @path already is a regular file of
+ * @size bytes (--update), if so return it open for reading
+ * so its contents can be checked.
+ *
+ * @fresh: Set if it has the mtime of the archive, then
+ *         there is no need to check the contents
+ */
+static int
+update_open(const char *path, uint64_t size, bool *fresh)
+{
+    struct stat sb;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return -1;
+    }
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) ||
+        (uint64_t)sb.st_size != size) {
+        close(fd);
+        return -1;
+    }
+
+    *fresh = sb.st_mtim.tv_sec == stamp.tv_sec &&
+             sb.st_mtim.tv_nsec == stamp.tv_nsec;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return fd;
+}
+
+/*
+ * Give an extracted file the mtime of the archive. It only
+ * saves reading the file on the next --update, so failing
+ * to do so is not an error.
+ */
+static void
+update_stamp(int fd)
+{
+    struct timespec times[2];
+
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1] = stamp;
+    futimens(fd, times);
+}
+
+/*
+ * Tell whether @len bytes at @off of @fd match @data
+ */
+static bool
+update_same(int fd, const char *data, size_t len, off_t off)
+{
+    char buf[UPDATE_BUFSZ];
+    size_t n;
+
+    while (len > 0) {
+        n = (len < sizeof(buf)) ? len : sizeof(buf);
+        if (pread_all(fd, buf, n, off) != 0 || memcmp(buf, data, n) != 0) {
+            return false;
+        }
+        data += n;
+        off += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+/*
+ * An unchanged file is kept, only its mode and mtime
+ * are fixed up
+ */
+static int
+update_keep(int fd, const char *path, mode_t mode)
+{
+    struct stat sb;
+    int error = 0;
+
+    ++stats.kept;
+    if (fstat(fd, &sb) == 0 && (sb.st_mode & 07777) != (mode & 07777) &&
+        fchmod(fd, mode & 07777) != 0) {
+        perror(path);
+        error = -errno;
+    }
+    update_stamp(fd);
+
+    close(fd);
+    return error;
+}
+
+/*
+ * Count the extents of an extracted file (--stats)
+ */
+static void
+output_stat(int fd)
+{
+    struct fiemap fm;
+    struct stat sb;
+
+    if (fstat(fd, &sb) != 0) {
+        return;
+    }
+
+    ++stats.files;
+    stats.bytes += sb.st_size;
+
+    /* No extent array, the kernel just counts them */
+    memset(&fm, 0, sizeof(fm));
+    fm.fm_length = FIEMAP_MAX_OFFSET;
+    fm.fm_flags = FIEMAP_FLAG_SYNC;
+    if (ioctl(fd, FS_IOC_FIEMAP, &fm) != 0) {
+        return;
+    }
+
+    stats.extents += fm.fm_mapped_extents;
+    if (fm.fm_mapped_extents > stats.maxext) {
+        stats.maxext = fm.fm_mapped_extents;
+    }
+}
+
+/*
+ * Done writing an extracted file. With --drop-cache or
+ * --sync file its writeback starts now, rather than piling
+ * up dirty pages. With --sync file, a file written at @tmp
+ * is handed over to the batch, which puts it in place, and
+ * @tmp is cleared.
+ */
+static int
+output_close(int fd, const char *path, char *tmp)
+{
+    struct sync_file *sf;
+
+    update_stamp(fd);
+    if (show_stats) {
+        output_stat(fd);
+    }
+
+    if (drop_cache || sync_mode == SYNC_FILE) {
+        sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    }
+
+    if (sync_mode == SYNC_FILE) {
+        sf = &syncfds[nsyncfds];
+        sf->fd = fd;
+        sf->tmp = sf->path = NULL;
+        if (tmp[0] != '\0') {
+            sf->tmp = strdup(tmp);
+            sf->path = strdup(path);
+            if (sf->tmp == NULL || sf->path == NULL) {
+                fprintf(stderr, "out of memory\n");
+                free(sf->tmp);
+                free(sf->path);
+                close(fd);
+                return -ENOMEM;
+            }
+            tmp[0] = '\0';
+        }
+        ++nsyncfds;
+        return (nsyncfds == SYNC_BATCH) ? sync_batch() : 0;
+    }
+
+    if (drop_cache) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    close(fd);
+    return 0;
+}
+
+/*
+ * Remember an extracted directory for the final
+ * sweep (--sync file).
+ */
+static int
+sync_dir(const char *path)
+{
+    char **dirs;
+
+    if (sync_mode != SYNC_FILE) {
+        return 0;
+    }
+
+    if ((nsyncdirs & (nsyncdirs + 1)) == 0) {
+        dirs = realloc(syncdirs, (nsyncdirs * 2 + 1) * sizeof(*dirs));
+        if (dirs == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return -ENOMEM;
+        }
+        syncdirs = dirs;
+    }
+    if ((syncdirs[nsyncdirs] = strdup(path)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+
+    ++nsyncdirs;
+    return 0;
+}
+
+/*
+ * Make what was extracted so far durable as asked by
+ * --sync. Directories are kept for another sweep
+ * unless @done.
+ */
+static int
+extract_sync(bool done)
+{
+    size_t i;
+    int fd, error = 0;
+
+    if (sync_mode == SYNC_FS) {
+        if ((fd = open(outpath, O_RDONLY | O_DIRECTORY)) < 0) {
+            perror(outpath);
+            return -errno;
+        }
+        if (syncfs(fd) != 0) {
+            perror("syncfs");
+            error = -errno;
+        }
+        close(fd);
+        return error;
+    }
+
+    if (sync_mode != SYNC_FILE) {
+        return 0;
+    }
+
+    /* The files are durable, now their directory entries */
+    error = sync_batch();
+    for (i = 0; i < nsyncdirs; ++i) {
+        fd = open(syncdirs[i], O_RDONLY | O_DIRECTORY);
+        if (fd < 0 || fsync(fd) != 0) {
+            perror(syncdirs[i]);
+            error = -errno;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (!done) {
+        return error;
+    }
+
+    for (i = 0; i < nsyncdirs; ++i) {
+        free(syncdirs[i]);
+    }
+    free(syncdirs);
+    syncdirs = NULL;
+    nsyncdirs = 0;
+    return error;
+}
+
+/*
+ * Push a file into the archive output
+ *
+ * @pathname: Full path name of file (NULL if EOF)
+ * @name: Name of file (for EOF, set to "EOF")
+ * @parent: Block of the parent directory (--relative-names)
+ */
+static int
+file_push(const char *pathname, const char *name, uint32_t parent)
+{
+    struct omar_relname rel;
+    struct omar_hdr hdr;
+    struct stat sb;
+    const char *bname;
+    int infd, srcfd, cachefd, error;
+    uint8_t sha[32];
+    uint64_t pad, xxh;
+    size_t len;
+
+    /* If we are at the end of the file, we are done */
+    if (pathname == NULL) {
+        return out_finish(&out, base, want_index ? &pathidx : NULL);
+    }
+
+    bname = name;
+    if (relnames && strrchr(name, '/') != NULL) {
+        bname = strrchr(name, '/') + 1;
+    }
+    if (strlen(bname) > UINT8_MAX) {
+        fprintf(stderr, "omar: %s: name too long\n", pathname);
+        return -ENAMETOOLONG;
+    }
+
+    /*
+     * Planning does not touch file data and a build cache
+     * hit does not need the source opened.
+     */
+    if (planning || cachepath != NULL) {
+        infd = -1;
+        if (stat(pathname, &sb) < 0) {
+            perror(pathname);
+            return -errno;
+        }
+    } else {
+        if ((infd = open(pathname, O_RDONLY)) < 0) {
+            perror("open");
+            return infd;
+        }
+        if ((error = fstat(infd, &sb)) < 0) {
+            close(infd);
+            return error;
+        }
+        posix_fadvise(infd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        if (drop_cache) {
+            posix_fadvise(infd, 0, 0, POSIX_FADV_NOREUSE);
+        }
+    }
+
+    if (want_index) {
+        error = index_add(&pathidx, name, out.off - base);
+        if (error != 0) {
+            close(infd);
+            return error;
+        }
+    }
+
+    /*
+     * Large files get stored as deduplicated chunks, which
+     * depend on the contents, so even a plan reads those.
+     */
+    if (chunking && S_ISREG(sb.st_mode) && sb.st_size >= CDC_THRESHOLD) {
+        if (infd < 0 && (infd = open(pathname, O_RDONLY)) < 0) {
+            perror("open");
+            return -errno;
+        }
+        pad = cdc.pad;
+        error = cdc_push(&cdc, &out, infd, &sb, name,
+                         (manifestpath != NULL) ? &manifest : NULL);
+        input_done(infd);
+        if (error != 0) {
+            fprintf(stderr, "omar: %s: %s\n", pathname, strerror(-error));
+            return error;
+        }
+        ++stats.files;
+        stats.bytes += sb.st_size;
+        stats.pad += cdc.pad - pad;
+        return 0;
+    }
+
+    if (sb.st_size > UINT32_MAX) {
+        fprintf(stderr, "omar: %s: file too large\n", pathname);
+        close(infd);
+        return -EFBIG;
+    }
+
+    memcpy(hdr.magic, OMAR_MAGIC, sizeof(hdr.magic));
+    hdr.type = S_ISDIR(sb.st_mode) ? OMAR_DIR : OMAR_REG;
+    hdr.mode = sb.st_mode;
+    hdr.len = sb.st_size;
+    hdr.rev = relnames ? OMAR_REV_REL : OMAR_REV;
+    hdr.namelen = strlen(bname);
+
+    if ((error = out_write(&out, &hdr, sizeof(hdr))) != 0) {
+        close(infd);
+        return error;
+    }
+    rel.parent = parent;
+    if (relnames && (error = out_write(&out, &rel, sizeof(rel))) != 0) {
+        close(infd);
+        return error;
+    }
+    if ((error = out_write(&out, bname, hdr.namelen)) != 0) {
+        close(infd);
+        return error;
+    }
+
+    /* The data follows the name, directories have none */
+    if (emitpath != NULL) {
+        error = (hdr.type == OMAR_DIR) ?
+            emit_add(&emit, name, hdr.mode, 0, 0) :
+            emit_add(&emit, name, hdr.mode, out.off, hdr.len);
+        if (error != 0) {
+            close(infd);
+            return error;
+        }
+    }
+
+    /* Pad directories to zero */
+    len = sizeof(hdr) + omar_namesz(&hdr);
+    if (hdr.type == OMAR_DIR) {
+        ++stats.dirs;
+        stats.pad += omar_span(&hdr) - len;
+        close(infd);
+        return out_zero(&out, omar_span(&hdr) - len);
+    }
+
+    /*
+     * Write the actual file contents, either spliced out of
+     * the build cache (padding included) or copied from the
+     * file itself.
+     */
+    cachefd = -1;
+    if (cachepath != NULL) {
+        cachefd = cache_get(&cache, pathname, &sb, len, sha, &xxh);
+    }
+    if (cachefd < 0 && infd < 0 && (infd = open(pathname, O_RDONLY)) < 0) {
+        perror(pathname);
+        return -errno;
+    }
+
+    srcfd = infd;
+    if (cachefd >= 0) {
+        ++cache.hits;
+        cache.saved += hdr.len;
+        srcfd = cachefd;
+        error = out_copy(&out, cachefd, 0, omar_span(&hdr) - len);
+        if (error == 0 && manifestpath != NULL) {
+            error = manifest_put(&manifest, name, sha, xxh);
+        }
+    } else if (cachepath != NULL) {
+        ++cache.misses;
+        posix_fadvise(infd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        if (drop_cache) {
+            posix_fadvise(infd, 0, 0, POSIX_FADV_NOREUSE);
+        }
+        error = cache_put(&cache, pathname, &sb, infd, len, &out, sha, &xxh);
+        if (error == 0 && manifestpath != NULL) {
+            error = manifest_put(&manifest, name, sha, xxh);
+        }
+    } else if (manifestpath != NULL) {
+        /* Hashed in the background as it goes by */
+        error = manifest_copy(&manifest, name, &out, infd, hdr.len);
+    } else {
+        error = out_copy(&out, infd, 0, hdr.len);
+    }
+    if (srcfd != infd) {
+        input_done(srcfd);
+    }
+    if (infd >= 0) {
+        input_done(infd);
+    }
+    if (error != 0) {
+        fprintf(stderr, "omar: %s: %s\n", pathname, strerror(-error));
+        return error;
+    }
+
+    /*
+     * If the file length is not a multiple of the block size,
+     * we'll need to pad out the rest to zero.
+     */
+    ++stats.files;
+    stats.bytes += hdr.len;
+    len += hdr.len;
+    stats.pad += omar_span(&hdr) - len;
+    return (cachepath != NULL) ? 0 : out_zero(&out, omar_span(&hdr) - len);
+}
+
+/*
+ * A directory entry of one of the input roots
+ *
+ * @name: Entry name
+ * @path: Source path
+ * @root: Index of the root it comes from
+ * @isdir: True if it is a directory
+ */
+struct walk_ent {
+    char *name;
+    char *path;
+    size_t root;
+    bool isdir;
+};
+
+/*
+ * The entries of one directory of the archive,
+ * gathered from all roots.
+ */
+struct walk_list {
+    struct walk_ent *ents;
+    size_t count;
+    size_t cap;
+};
+
+static int
+walk_add(struct walk_list *list, const char *name, size_t namelen,
+         const char *path, size_t root, bool isdir)
+{
+    struct walk_ent *ent;
+    size_t cap;
+
+    if (list->count == list->cap) {
+        cap = (list->cap == 0) ? 64 : list->cap * 2;
+        if ((ent = realloc(list->ents, cap * sizeof(*ent))) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return -ENOMEM;
+        }
+        list->ents = ent;
+        list->cap = cap;
+    }
+
+    ent = &list->ents[list->count];
+    ent->name = strndup(name, namelen);
+    ent->path = strdup(path);
+    ent->root = root;
+    ent->isdir = isdir;
+    if (ent->name == NULL || ent->path == NULL) {
+        free(ent->name);
+        free(ent->path);
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+
+    ++list->count;
+    return 0;
+}
+
+static void
+walk_free(struct walk_list *list)
+{
+    size_t i;
+
+    for (i = 0; i < list->count; ++i) {
+        free(list->ents[i].name);
+        free(list->ents[i].path);
+    }
+    free(list->ents);
+}
+
+static int
+walk_cmp(const void *a, const void *b)
+{
+    const struct walk_ent *ea = a, *eb = b;
+    int r;
+
+    if ((r = strcmp(ea->name, eb->name)) != 0) {
+        return r;
+    }
+
+    return (ea->root > eb->root) - (ea->root < eb->root);
+}
+
+/*
+ * Add the entries of a source directory, one
+ * that does not exist adds nothing.
+ */
+static int
+walk_read(struct walk_list *list, const char *src, size_t root)
+{
+    DIR *dp;
+    struct dirent *ent;
+    char pathbuf[OMAR_PATHMAX];
+    int error = 0;
+
+    if ((dp = opendir(src)) == NULL) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            return 0;
+        }
+        perror(src);
+        return -errno;
+    }
+
+    while ((ent = readdir(dp)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        if (ent->d_type != DT_DIR && ent->d_type != DT_REG) {
+            continue;
+        }
+
+        if ((size_t)snprintf(pathbuf, sizeof(pathbuf), "%s/%s", src,
+                             ent->d_name) >= sizeof(pathbuf)) {
+            fprintf(stderr, "omar: %s/%s: path too long\n", src, ent->d_name);
+            error = -ENAMETOOLONG;
+            break;
+        }
+        error = walk_add(list, ent->d_name, strlen(ent->d_name), pathbuf,
+                         root, ent->d_type == DT_DIR);
+        if (error != 0) {
+            break;
+        }
+    }
+
+    closedir(dp);
+    return error;
+}
+
+/*
+ * Gather what each root has at @dir of the archive. A root
+ * whose prefix lies below @dir contributes the next directory
+ * of its prefix, made from the root directory itself.
+ */
+static int
+walk_list(struct walk_list *list, const char *dir)
+{
+    const char *prefix, *rest;
+    size_t i, plen, dlen;
+    char src[PATH_MAX];
+    int error = 0;
+
+    dlen = strlen(dir);
+    for (i = 0; i < nroots && error == 0; ++i) {
+        prefix = roots[i].prefix;
+        plen = strlen(prefix);
+
+        if (plen <= dlen) {
+            if (plen > 0 && (strncmp(dir, prefix, plen) != 0 ||
+                (dir[plen] != '\0' && dir[plen] != '/'))) {
+                continue;
+            }
+            rest = dir + plen + (dir[plen] == '/');
+            snprintf(src, sizeof(src), "%s%s%s", roots[i].path,
+                     (*rest != '\0') ? "/" : "", rest);
+            error = walk_read(list, src, i);
+            continue;
+        }
+
+        if (dlen > 0 && (strncmp(prefix, dir, dlen) != 0 || prefix[dlen] != '/')) {
+            continue;
+        }
+        rest = prefix + dlen + (dlen > 0);
+        error = walk_add(list, rest, strcspn(rest, "/"), roots[i].path, i, true);
+    }
+
+    return error;
+}
+
+/*
+ * Archive directory @dir (relative to the top, "" for
+ * the top itself) out of all input roots. Entries come
+ * out sorted by name and when several roots have the same
+ * path the last one given wins, directories being merged.
+ *
+ * @parent: Block of the header of @dir (--relative-names)
+ */
+static int
+archive_create(const char *dir, uint32_t parent)
+{
+    struct walk_list list = {0};
+    struct walk_ent *ent;
+    char namebuf[OMAR_PATHMAX];
+    uint64_t blk;
+    size_t i;
+    int error;
+
+    if ((error = walk_list(&list, dir)) != 0) {
+        walk_free(&list);
+        return error;
+    }
+
+    qsort(list.ents, list.count, sizeof(*list.ents), walk_cmp);
+    for (i = 0; i < list.count && error == 0; ++i) {
+        ent = &list.ents[i];
+        if (i + 1 < list.count && strcmp(ent->name, ent[1].name) == 0) {
+            continue;
+        }
+
+        if (*dir == '\0') {
+            snprintf(namebuf, sizeof(namebuf), "%s", ent->name);
+        } else {
+            snprintf(namebuf, sizeof(namebuf), "%s/%s", dir, ent->name);
+        }
+
+        /* Filtered out directories are never opened */
+        if (filter_skip(&filter, namebuf, ent->isdir)) {
+            continue;
+        }
+
+        /*
+         * Files are spread over shards by a hash of their path.
+         * Every shard gets all directories, stitching keeps the
+         * first copy of each.
+         */
+        if (nshards > 0 && !ent->isdir && hash_str(namebuf) % nshards != shard) {
+            continue;
+        }
+
+        if (ent->isdir) {
+            if (!planning) {
+                fprintf(listfp, "%s [d]\n", namebuf);
+            }
+
+            /* Children refer to the block of this header */
+            blk = (out.off - base) / BLOCK_SIZE;
+            if (relnames && blk >= OMAR_REL_TOP) {
+                fprintf(stderr, "omar: archive too large for relative names\n");
+                error = -EFBIG;
+                break;
+            }
+            if ((error = file_push(ent->path, namebuf, parent)) == 0) {
+                error = archive_create(namebuf, blk);
+            }
+        } else {
+            if (!planning) {
+                fprintf(listfp, "%s [f]\n", namebuf);
+            }
+            error = file_push(ent->path, namebuf, parent);
+        }
+    }
+
+    walk_free(&list);
+    return error;
+}
+
+/*
+ * Add an input root (-i), left whole until we know
+ * it is root[:prefix] rather than an archive to extract.
+ */
+static int
+root_add(const char *arg)
+{
+    if (nroots == NELEM(roots)) {
+        fprintf(stderr, "omar: too many input roots\n");
+        return -1;
+    }
+    if (strlen(arg) >= sizeof(roots[nroots].arg)) {
+        fprintf(stderr, "omar: %s: path too long\n", arg);
+        return -1;
+    }
+
+    strcpy(roots[nroots].arg, arg);
+    roots[nroots].path = roots[nroots].arg;
+    roots[nroots].prefix = "";
+    ++nroots;
+    return 0;
+}
+
+/*
+ * Split the input roots into root and prefix, when
+ * creating an archive.
+ */
+static void
+roots_split(void)
+{
+    char *prefix;
+    size_t i;
+
+    for (i = 0; i < nroots; ++i) {
+        if ((prefix = strchr(roots[i].arg, ':')) == NULL) {
+            continue;
+        }
+
+        *prefix++ = '\0';
+        while (*prefix == '/') {
+            ++prefix;
+        }
+        while (*prefix != '\0' && prefix[strlen(prefix) - 1] == '/') {
+            prefix[strlen(prefix) - 1] = '\0';
+        }
+        roots[i].prefix = prefix;
+    }
+}
+
+/*
+ * Push an MBR to the start of the OMAR image
+ */
+static int
+mbr_push(const char *path)
+{
+    int fd, error;
+    char mbr[512];
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return fd;
+    }
+
+    /* Read the MBR */
+    if ((error = read(fd, mbr, sizeof(mbr))) < 0) {
+        return error;
+    }
+
+    close(fd);
+    return out_write(&out, mbr, sizeof(mbr));
+}
+
+/*
+ * Extract a single file
+ *
+ * @hp: File header
+ * @data: Data to extract
+ * @len: Length of data
+ * @path: Path to output file
+ */
+static int
+extract_single(struct omar_hdr *hp, char *data, size_t len, const char *path)
+{
+    char tmp[PATH_MAX];
+    bool fresh;
+    int fd, error;
+
+    if (updating && (fd = update_open(path, len, &fresh)) >= 0) {
+        if (fresh || update_same(fd, data, len, 0)) {
+            return update_keep(fd, path, hp->mode);
+        }
+        close(fd);
+    }
+
+    if ((fd = output_open(path, hp->mode, len, tmp)) < 0) {
+        return fd;
+    }
+
+    if ((error = par_pwrite(fd, data, len, 0)) != 0) {
+        close(fd);
+    } else {
+        error = output_close(fd, path, tmp);
+    }
+
+    return output_commit(path, tmp, error);
+}
+
+/*
+ * Chunks of a file being extracted
+ *
+ * @fd: Output file
+ * @base: Start of the archive
+ * @tab: Chunk table
+ * @pos: File offset of each chunk
  */
+struct chunk_xfer {
+    int fd;
+    char *base;
+    char *tab;
+    off_t *pos;
+    atomic_int error;
+};
+
 static void
-mkpath(struct omar_hdr *hdr, const char *path)
+chunk_write(void *arg, size_t i)
 {
-    size_t len;
-    char buf[256];
-    char cwd[256];
-    char *p = NULL;
+    struct chunk_xfer *xfer = arg;
+    struct omar_chunk chunk;
+    int error;
 
-    len = snprintf(buf, sizeof(buf), "%s", path);
-    if (buf[len - 1] == '/') {
-        buf[len - 1] = '\0';
-    }
-    for (p = (char *)buf + 1; *p != '\0'; ++p) {
-        if (*p == '/') {
-            *p = '\0';
-            mkdir(buf, hdr->mode);
-            *p = '/';
-        }
+    memcpy(&chunk, xfer->tab + i * sizeof(chunk), sizeof(chunk));
+    error = pwrite_all(xfer->fd, xfer->base + chunk.off, chunk.len,
+                       xfer->pos[i]);
+    if (error != 0) {
+        atomic_store(&xfer->error, error);
     }
-
-    mkdir(buf, hdr->mode);
 }
 
 /*
- * Push a file into the archive output
+ * Extract a chunked file
  *
- * @pathname: Full path name of file (NULL if EOF)
- * @name: Name of file (for EOF, set to "EOF")
+ * @hp: File header
+ * @base: Start of the archive
+ * @size: Size of the archive
+ * @data: Entry data (chunk table)
+ * @path: Path to output file
  */
 static int
-file_push(const char *pathname, const char *name)
+extract_chunked(struct omar_hdr *hp, char *base, size_t size, char *data,
+                const char *path)
 {
-    struct omar_hdr hdr;
-    struct stat sb;
-    int infd, rem, error;
-    int pad_len;
-    size_t len;
-    char *buf;
+    struct omar_chunkhdr ch;
+    struct omar_chunk chunk;
+    struct chunk_xfer xfer;
+    char tmp[PATH_MAX];
+    off_t pos = 0;
+    uint32_t i;
+    bool fresh;
+    int error = 0;
 
-    hdr.type = OMAR_REG;
+    memcpy(&ch, data, sizeof(ch));
+    if (sizeof(ch) + (size_t)ch.nchunks * sizeof(chunk) > hp->len) {
+        return -EINVAL;
+    }
 
-    /* Attempt to open the input file if not EOF */
-    if (pathname != NULL) {
-        if ((infd = open(pathname, O_RDONLY)) < 0) {
-            perror("open");
-            return infd;
-        }
+    xfer.base = base;
+    xfer.tab = data + sizeof(ch);
+    xfer.pos = malloc((ch.nchunks + 1) * sizeof(*xfer.pos));
+    if (xfer.pos == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
 
-        if ((error = fstat(infd, &sb)) < 0) {
-            return error;
+    for (i = 0; i < ch.nchunks; ++i) {
+        memcpy(&chunk, xfer.tab + i * sizeof(chunk), sizeof(chunk));
+        if (chunk.off + chunk.len > size) {
+            free(xfer.pos);
+            return -EINVAL;
         }
+        xfer.pos[i] = pos;
+        pos += chunk.len;
+    }
 
-        if (S_ISDIR(sb.st_mode)) {
-            hdr.type = OMAR_DIR;
+    if (updating && (xfer.fd = update_open(path, pos, &fresh)) >= 0) {
+        for (i = 0; i < ch.nchunks && !fresh; ++i) {
+            memcpy(&chunk, xfer.tab + i * sizeof(chunk), sizeof(chunk));
+            if (!update_same(xfer.fd, base + chunk.off, chunk.len, xfer.pos[i])) {
+                break;
+            }
         }
-        hdr.mode = sb.st_mode;
+        if (fresh || i == ch.nchunks) {
+            free(xfer.pos);
+            return update_keep(xfer.fd, path, hp->mode);
+        }
+        close(xfer.fd);
+    }
+
+    if ((xfer.fd = output_open(path, hp->mode, pos, tmp)) < 0) {
+        free(xfer.pos);
+        return xfer.fd;
     }
 
-    hdr.len = (pathname == NULL) ? 0 : sb.st_size;
-    hdr.rev = OMAR_REV;
-    hdr.namelen = strlen(name);
+    /* Every chunk knows where it goes, write them all at once */
+    atomic_init(&xfer.error, 0);
+    par_for(ch.nchunks, chunk_write, &xfer);
+    error = atomic_load(&xfer.error);
 
-    /*
-     * If we are at the end of the file, use the OMAR_EOF
-     * magic constant instant of the usual OMAR_MAGIC.
-     */
-    if (pathname == NULL) {
-        memcpy(hdr.magic, OMAR_EOF, sizeof(hdr.magic));
+    free(xfer.pos);
+    if (error != 0) {
+        close(xfer.fd);
     } else {
-        memcpy(hdr.magic, OMAR_MAGIC, sizeof(hdr.magic));
+        error = output_close(xfer.fd, path, tmp);
     }
 
-    write(outfd, &hdr, sizeof(hdr));
-    write(outfd, name, hdr.namelen);
+    return output_commit(path, tmp, error);
+}
 
-    /* If we are at the end of file, we are done */
-    if (pathname == NULL) {
-        close(infd);
-        return 0;
-    }
+/*
+ * Build the full path of a parent relative entry into
+ * @path, walking up its parents (which all come before
+ * it) and putting basenames in from the right.
+ */
+static int
+rel_path(char *buf, struct omar_hdr *hdr, char *path, size_t size)
+{
+    struct omar_relname rel;
+    char *p = path + size - 1;
+    size_t blk;
 
-    /* Pad directories to zero */
-    if (hdr.type == OMAR_DIR) {
-        len = sizeof(hdr) + hdr.namelen;
-        rem = len & (BLOCK_SIZE - 1);
-        pad_len = BLOCK_SIZE - rem;
-
-        buf = malloc(pad_len);
-        memset(buf, 0, pad_len);
-        write(outfd, buf, pad_len);
-        free(buf);
-        return 0;
-    }
+    *p = '\0';
+    for (;;) {
+        memcpy(&rel, (char *)hdr + sizeof(*hdr), sizeof(rel));
+        if ((size_t)(p - path) < hdr->namelen + 1u) {
+            return -ENAMETOOLONG;
+        }
+        p -= hdr->namelen;
+        memcpy(p, (char *)hdr + sizeof(*hdr) + sizeof(rel), hdr->namelen);
+        if (rel.parent == OMAR_REL_TOP) {
+            break;
+        }
 
-    /* We need the file data now */
-    buf = malloc(hdr.len);
-    if (buf == NULL) {
-        printf("out of memory\n");
-        close(infd);
-        return -ENOMEM;
-    }
-    if (read(infd, buf, hdr.len) <= 0) {
-        perror("read");
-        close(infd);
-        return -EIO;
+        *--p = '/';
+        blk = ((char *)hdr - buf) / BLOCK_SIZE;
+        if (rel.parent >= blk) {
+            return -EINVAL;
+        }
+        hdr = (struct omar_hdr *)(buf + (size_t)rel.parent * BLOCK_SIZE);
+        if (memcmp(hdr->magic, OMAR_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->type != OMAR_DIR || hdr->rev != OMAR_REV_REL) {
+            return -EINVAL;
+        }
     }
 
-    /*
-     * Write the actual file contents, if the file length is not
-     * a multiple of the block size, we'll need to pad out the rest
-     * to zero.
-     */
-    write(outfd, buf, hdr.len);
-    len = sizeof(hdr) + (hdr.namelen + hdr.len);
-    rem = len & (BLOCK_SIZE - 1);
-    if (rem != 0) {
-        /* Compute the padding length */
-        pad_len = BLOCK_SIZE - rem;
-
-        buf = realloc(buf, pad_len);
-        memset(buf, 0, pad_len);
-        write(outfd, buf, pad_len);
-    }
-    close(infd);
-    free(buf);
+    memmove(path, p, strlen(p) + 1);
     return 0;
 }
 
 /*
- * Start creating an archive from the
- * basepath of a directory.
+ * Extract the entries of an archive read into @buf
+ *
+ * @pass: Which entries to extract, EXTRACT_*
  */
 static int
-archive_create(const char *base, const char *dirname)
+extract_pass(char *buf, size_t size, int pass)
 {
-    DIR *dp;
-    struct dirent *ent;
-    struct omar_hdr hdr;
-    const char *p = NULL, *p1;
-    char pathbuf[256];
-    char namebuf[256];
+    char *name, *p;
+    struct omar_hdr *hdr;
+    bool hot;
+    int error = 0;
+    size_t len;
+    off_t off;
+    char namebuf[OMAR_PATHMAX];
+    char pathbuf[PATH_MAX];
 
-    dp = opendir(base);
-    if (dp == NULL) {
-        perror("opendir");
-        return -ENOENT;
-    }
+    hdr = (struct omar_hdr *)buf;
+    for (;;) {
+        if (memcmp(hdr->magic, OMAR_EOF, sizeof(OMAR_EOF)) == 0) {
+            if (pass != EXTRACT_HOT) {
+                printf("EOF!\n");
+            }
+            return 0;
+        }
 
-    while ((ent = readdir(dp)) != NULL) {
-        if (ent->d_name[0] == '.') {
+        /* Ensure the header is valid */
+        if (memcmp(hdr->magic, "OMAR", 4) != 0) {
+            fprintf(stderr, "bad magic\n");
+            break;
+        }
+        if (hdr->rev != OMAR_REV && hdr->rev != OMAR_REV_REL) {
+            fprintf(stderr, "cannot extract rev %d archive\n", hdr->rev);
+            fprintf(stderr, "current OMAR revision: %d\n", OMAR_REV);
+        }
+
+        /* Skip entries replaced by 'omar update' */
+        if (hdr->type == OMAR_DEL) {
+            hdr = (struct omar_hdr *)((char *)hdr + omar_span(hdr));
             continue;
         }
 
-        snprintf(pathbuf, sizeof(pathbuf), "%s/%s", base, ent->d_name);
-        snprintf(namebuf, sizeof(namebuf), "%s/%s", dirname, ent->d_name);
-        p1 = strip_root(namebuf);
+        name = (char *)hdr + sizeof(struct omar_hdr);
+        if (hdr->rev == OMAR_REV_REL) {
+            if ((error = rel_path(buf, hdr, namebuf, sizeof(namebuf))) != 0) {
+                fprintf(stderr, "bad relative name\n");
+                break;
+            }
+        } else {
+            memcpy(namebuf, name, hdr->namelen);
+            namebuf[hdr->namelen] = '\0';
+        }
+
+        /* Directories go first, along with the hot files */
+        if (pass != EXTRACT_ALL) {
+            hot = hdr->type == OMAR_DIR || map_get(&hotset, namebuf) != NULL;
+            if (hot != (pass == EXTRACT_HOT)) {
+                hdr = (struct omar_hdr *)((char *)hdr + omar_span(hdr));
+                continue;
+            }
+        }
+
+        /* Get the full path */
+        len = snprintf(pathbuf, sizeof(pathbuf), "%s/%s", outpath, namebuf);
+        if (len < 0) {
+            return len;
+        }
+        printf("unpacking %s\n", pathbuf);
 
-        if (ent->d_type == DT_DIR) {
-            printf("%s [d]\n", p1);
-            file_push(pathbuf, p1);
-            archive_create(pathbuf, namebuf);
-        } else if (ent->d_type == DT_REG) {
-            printf("%s [f]\n", p1);
-            file_push(pathbuf, p1);
+        if (hdr->type == OMAR_DIR) {
+            off = 512;
+            mkpath(hdr, pathbuf);
+            ++stats.dirs;
+            if ((error = sync_dir(pathbuf)) != 0) {
+                break;
+            }
+        } else if (hdr->type == OMAR_CHUNKED) {
+            off = omar_span(hdr);
+            p = (char *)hdr + sizeof(struct omar_hdr) + omar_namesz(hdr);
+            if ((error = extract_chunked(hdr, buf, size, p, pathbuf)) != 0) {
+                break;
+            }
+        } else {
+            off = omar_span(hdr);
+            p = (char *)hdr + sizeof(struct omar_hdr);
+            p += omar_namesz(hdr);
+            if ((error = extract_single(hdr, p, hdr->len, pathbuf)) != 0) {
+                break;
+            }
         }
+
+        hdr = (struct omar_hdr *)((char *)hdr + off);
     }
 
-    return 0;
+    return (error != 0) ? error : -EINVAL;
 }
 
 /*
- * Push an MBR to the start of the OMAR image
+ * Load the hot set (--hot), one path per line
  */
 static int
-mbr_push(const char *path)
+hot_load(const char *path)
 {
-    int fd, error;
-    char mbr[512];
+    FILE *fp;
+    char *line = NULL, *p;
+    size_t cap = 0;
+    ssize_t len;
+    int error = 0;
 
-    fd = open(path, O_RDONLY);
-    if (fd < 0) {
-        return fd;
+    if ((fp = fopen(path, "r")) == NULL) {
+        perror(path);
+        return -errno;
     }
 
-    /* Read the MBR */
-    if ((error = read(fd, mbr, sizeof(mbr))) < 0) {
-        return error;
+    while ((len = getline(&line, &cap, fp)) > 0) {
+        if (line[len - 1] == '\n') {
+            line[--len] = '\0';
+        }
+        for (p = line; *p == '/'; ++p);
+        if (*p == '\0') {
+            continue;
+        }
+        if (map_put(&hotset, p) == NULL) {
+            fprintf(stderr, "out of memory\n");
+            error = -ENOMEM;
+            break;
+        }
     }
 
-    write(outfd, mbr, sizeof(mbr));
-    return 0;
+    free(line);
+    fclose(fp);
+    return error;
 }
 
 /*
- * Extract a single file
- *
- * @hp: File header
- * @data: Data to extract
- * @len: Length of data
- * @path: Path to output file
+ * The hot set is out, let whoever waits on it know
+ * (--ready and --notify-fd) and leave the disk to
+ * others for the rest. The rest is not detached: this
+ * process goes on with it at idle I/O priority, and
+ * its exit status covers the whole extraction.
  */
 static int
-extract_single(struct omar_hdr *hp, char *data, size_t len, const char *path)
+hot_ready(void)
 {
-    int fd;
+    int fd, error;
 
-    if ((fd = open(path, O_WRONLY | O_CREAT, hp->mode)) < 0) {
-        return fd;
+    /*
+     * Nothing is ready before it is durable: the hot files
+     * and, as every directory is hot, their directory entries.
+     */
+    if ((error = extract_sync(false)) != 0) {
+        return error;
     }
 
-    return write(fd, data, len) > 0 ? 0 : -1;
+    if (readypath != NULL) {
+        if ((fd = open(readypath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+            perror(readypath);
+            return -errno;
+        }
+        close(fd);
+    }
+    if (notifyfd >= 0) {
+        fflush(stdout);
+        error = write_all(notifyfd, "READY=1\n", 8);
+        close(notifyfd);
+        notifyfd = -1;
+        if (error != 0) {
+            fprintf(stderr, "omar: failed to notify readiness: %s\n",
+                    strerror(-error));
+            return error;
+        }
+    }
+
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+            IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0));
+    return 0;
 }
 
 /*
@@ -343,14 +1569,9 @@ extract_single(struct omar_hdr *hp, char *data, size_t len, const char *path)
 static int
 archive_extract(void)
 {
-    char *buf, *name, *p;
+    char *buf;
     struct stat sb;
-    struct omar_hdr *hdr;
     int fd, error;
-    size_t len;
-    off_t off;
-    char namebuf[256];
-    char pathbuf[256];
 
     if ((fd = open(inpath, O_RDONLY)) < 0) {
         perror("open");
@@ -362,6 +1583,7 @@ archive_extract(void)
         close(fd);
         return error;
     }
+    stamp = sb.st_mtim;
 
     buf = malloc(sb.st_size);
     if (buf == NULL) {
@@ -370,76 +1592,130 @@ archive_extract(void)
         return -ENOMEM;
     }
 
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
     if (read(fd, buf, sb.st_size) <= 0) {
         fprintf(stderr, "omar: no data read\n");
         close(fd);
         return -EIO;
     }
+    if (drop_cache) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
 
-    hdr = (struct omar_hdr *)buf;
-    for (;;) {
-        if (memcmp(hdr->magic, OMAR_EOF, sizeof(OMAR_EOF)) == 0) {
-            printf("EOF!\n");
-            return 0;
+    error = sync_dir(outpath);
+    if (error == 0 && hotpath == NULL) {
+        error = extract_pass(buf, sb.st_size, EXTRACT_ALL);
+        if (error == 0 && (readypath != NULL || notifyfd >= 0)) {
+            error = hot_ready();
         }
-
-        /* Ensure the header is valid */
-        if (memcmp(hdr->magic, "OMAR", 4) != 0) {
-            fprintf(stderr, "bad magic\n");
-            break;
+    } else if (error == 0) {
+        error = extract_pass(buf, sb.st_size, EXTRACT_HOT);
+        if (error == 0) {
+            error = hot_ready();
         }
-        if (hdr->rev != OMAR_REV) {
-            fprintf(stderr, "cannot extract rev %d archive\n", hdr->rev);
-            fprintf(stderr, "current OMAR revision: %d\n", OMAR_REV);
+        if (error == 0) {
+            error = extract_pass(buf, sb.st_size, EXTRACT_COLD);
         }
+    }
+    if (error == 0) {
+        error = extract_sync(true);
+    }
 
-        name = (char *)hdr + sizeof(struct omar_hdr);
-        memcpy(namebuf, name, hdr->namelen);
-        namebuf[hdr->namelen] = '\0';
+    free(buf);
+    close(fd);
+    return error;
+}
 
-        /* Get the full path */
-        len = snprintf(pathbuf, sizeof(pathbuf), "%s/%s", outpath, namebuf);
-        if (len < 0) {
-            free(buf);
-            return len;
-        }
-        printf("unpacking %s\n", pathbuf);
+/*
+ * Report the layout of an image that was
+ * only planned (--plan)
+ */
+static void
+plan_dump(void)
+{
+    printf("files: %" PRIu64 ", directories: %" PRIu64 "\n",
+           stats.files, stats.dirs);
+    printf("padding: %" PRIu64 " bytes (%.1f%%)\n", stats.pad,
+           (out.off == 0) ? 0.0 : 100.0 * stats.pad / out.off);
+    printf("size: %" PRIu64 " bytes\n", (uint64_t)out.off);
+}
 
-        if (hdr->type == OMAR_DIR) {
-            off = 512;
-            mkpath(hdr, pathbuf);
-        } else {
-            off = ALIGN_UP(sizeof(*hdr) + hdr->namelen + hdr->len, BLOCK_SIZE);
-            p = (char *)hdr + sizeof(struct omar_hdr);
-            p += hdr->namelen;
-            extract_single(hdr, p, hdr->len, pathbuf);
+/*
+ * Dump archive creation or extraction statistics (--stats)
+ */
+static void
+stats_dump(void)
+{
+    uint64_t total;
+
+    fprintf(stderr, "files: %" PRIu64 ", directories: %" PRIu64 "\n",
+            stats.files, stats.dirs);
+    if (mode == OMAR_EXTRACT) {
+        fprintf(stderr, "data: %" PRIu64 " bytes\n", stats.bytes);
+        if (updating) {
+            fprintf(stderr, "unchanged: %" PRIu64 " files\n", stats.kept);
         }
+        fprintf(stderr, "extents: %" PRIu64 " (%.2f per file, at most %"
+                PRIu64 ")\n", stats.extents,
+                (stats.files == 0) ? 0.0 : (double)stats.extents / stats.files,
+                stats.maxext);
+        return;
+    }
+    fprintf(stderr, "data: %" PRIu64 " bytes, padding: %" PRIu64 " bytes\n",
+            stats.bytes, stats.pad);
 
-        hdr = (struct omar_hdr *)((char *)hdr + off);
-        memset(namebuf, 0, sizeof(namebuf));
+    if (chunking) {
+        fprintf(stderr, "chunks: %" PRIu64 " total, %" PRIu64 " unique, "
+                "%" PRIu64 " bytes deduplicated\n",
+                cdc.nchunks, cdc.nunique, cdc.dedup);
     }
 
-    free(buf);
+    if (cachepath == NULL) {
+        return;
+    }
+
+    total = cache.hits + cache.misses;
+    fprintf(stderr, "cache: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hit rate)\n",
+            cache.hits, cache.misses,
+            (total == 0) ? 0.0 : 100.0 * cache.hits / total);
+    fprintf(stderr, "cache: %" PRIu64 " bytes not read from sources\n",
+            cache.saved);
 }
 
 int
 main(int argc, char **argv)
 {
-    int optc, retval;
+    int optc, retval = 0;
     int error, flags;
+    struct stat sb;
+    size_t i;
 
     if (argc < 2) {
         help();
         return -1;
     }
 
-    while ((optc = getopt(argc, argv, "xhi:m:o:")) != -1) {
+    for (i = 0; i < NELEM(cmdtab); ++i) {
+        if (strcmp(argv[1], cmdtab[i].name) == 0) {
+            return cmdtab[i].main(argc - 1, &argv[1]);
+        }
+    }
+
+    /* Dotfiles are left out unless included again */
+    if (filter_add(&filter, ".*", false) != 0) {
+        return -1;
+    }
+
+    while ((optc = getopt_long(argc, argv, "xhi:m:o:", longopts, NULL)) != -1) {
         switch (optc) {
         case 'x':
             mode = OMAR_EXTRACT;
             break;
         case 'i':
             inpath = optarg;
+            if (root_add(optarg) != 0) {
+                return -1;
+            }
             break;
         case 'o':
             outpath = optarg;
@@ -447,6 +1723,78 @@ main(int argc, char **argv)
         case 'm':
             mbrpath = optarg;
             break;
+        case OPT_CACHE:
+            cachepath = optarg;
+            break;
+        case OPT_STATS:
+            show_stats = true;
+            break;
+        case OPT_CHUNK:
+            chunking = true;
+            break;
+        case OPT_INDEX:
+            want_index = true;
+            break;
+        case OPT_DIRS:
+            want_index = true;
+            pathidx.dirs = true;
+            break;
+        case OPT_RELNAMES:
+            relnames = true;
+            break;
+        case OPT_BLOOM:
+            want_index = true;
+            pathidx.bloom = true;
+            break;
+        case OPT_EXCLUDE:
+        case OPT_INCLUDE:
+            if (filter_add(&filter, optarg, optc == OPT_INCLUDE) != 0) {
+                return -1;
+            }
+            break;
+        case OPT_DROP:
+            drop_cache = true;
+            break;
+        case OPT_MANIFEST:
+            manifestpath = optarg;
+            break;
+        case OPT_EMIT:
+            emitpath = optarg;
+            break;
+        case OPT_HOT:
+            hotpath = optarg;
+            break;
+        case OPT_READY:
+            readypath = optarg;
+            break;
+        case OPT_NOTIFY:
+            notifyfd = atoi(optarg);
+            break;
+        case OPT_UPDATE:
+            updating = true;
+            break;
+        case OPT_SYNC:
+            if (strcmp(optarg, "none") == 0) {
+                sync_mode = SYNC_NONE;
+            } else if (strcmp(optarg, "fs") == 0) {
+                sync_mode = SYNC_FS;
+            } else if (strcmp(optarg, "file") == 0) {
+                sync_mode = SYNC_FILE;
+            } else {
+                fprintf(stderr, "omar: bad sync mode \"%s\"\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_PLAN:
+            planning = true;
+            break;
+        case OPT_SHARD:
+            if (sscanf(optarg, "%u/%u", &shard, &nshards) != 2 ||
+                shard >= nshards) {
+                fprintf(stderr, "omar: bad shard \"%s\"\n", optarg);
+                return -1;
+            }
+            break;
         case 'h':
             help();
             return 0;
@@ -461,24 +1809,68 @@ main(int argc, char **argv)
         help();
         return -1;
     }
-    if (outpath == NULL) {
+    if (outpath == NULL && !planning) {
         fprintf(stderr, "omar: no output path\n");
         help();
         return -1;
     }
 
+    /* Chunked entries write their own headers */
+    if (relnames && chunking) {
+        fprintf(stderr, "omar: --relative-names does not work with --chunk\n");
+        return -1;
+    }
+
+    /* Emitted tables point into one whole, plain image file */
+    if (emitpath != NULL && (mode != OMAR_ARCHIVE || planning || chunking ||
+                             nshards > 0 || strcmp(outpath, "-") == 0)) {
+        fprintf(stderr, "omar: --emit-c needs a plain image written to a file\n");
+        return -1;
+    }
+
     /*
      * Do our specific job based on the mode
      * OMAR is set to be in.
      */
     switch (mode) {
     case OMAR_ARCHIVE:
-        /* Begin archiving the file */
-        outfd = open(outpath, O_WRONLY | O_CREAT, 0700);
-        if (outfd < 0) {
+        roots_split();
+        for (i = 0; i < nroots; ++i) {
+            if (stat(roots[i].path, &sb) != 0 || !S_ISDIR(sb.st_mode)) {
+                fprintf(stderr, "omar: %s: not a directory\n", roots[i].path);
+                return -1;
+            }
+        }
+
+        /*
+         * Begin archiving the file, a plan has no output and
+         * "-" streams it to stdout (paths are listed on stderr).
+         */
+        listfp = stdout;
+        if (planning) {
+            outfd = -1;
+            cachepath = NULL;
+        } else if (strcmp(outpath, "-") == 0) {
+            if (isatty(STDOUT_FILENO)) {
+                fprintf(stderr, "omar: refusing to write an archive to a terminal\n");
+                return -1;
+            }
+            outfd = STDOUT_FILENO;
+            listfp = stderr;
+        } else {
+            outfd = open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0700);
+        }
+        if (outfd < 0 && !planning) {
             printf("omar: failed to open output file\n");
             return outfd;
         }
+        if ((retval = out_init(&out, outfd)) != 0) {
+            return retval;
+        }
+        out.drop = drop_cache;
+        if (cachepath != NULL && (retval = cache_open(&cache, cachepath)) != 0) {
+            return retval;
+        }
 
         /* If we can, push an MBR */
         if (mbrpath != NULL) {
@@ -488,17 +1880,66 @@ main(int argc, char **argv)
             return retval;
         }
 
-        retval = archive_create(inpath, basename((char *)inpath));
-        file_push(NULL, "EOF");
+        if (planning) {
+            manifestpath = NULL;
+        }
+        if (manifestpath != NULL &&
+            (retval = manifest_open(&manifest)) != 0) {
+            return retval;
+        }
+
+        base = out.off;
+        if (chunking) {
+            cdc_init(&cdc, base);
+        }
+
+        /* Shards are partial archives, left for 'omar stitch' */
+        retval = archive_create("", OMAR_REL_TOP);
+        if (retval == 0 && nshards > 0) {
+            retval = out_flush(&out);
+        } else if (retval == 0) {
+            retval = file_push(NULL, "EOF", OMAR_REL_TOP);
+        }
+        if (manifestpath != NULL) {
+            error = manifest_close(&manifest, (retval == 0) ? manifestpath : NULL);
+            retval = (retval == 0) ? error : retval;
+        }
+        if (retval == 0 && emitpath != NULL) {
+            retval = emit_write(&emit, emitpath, outpath);
+        }
+        if (retval == 0 && planning) {
+            plan_dump();
+        }
+        if (show_stats) {
+            stats_dump();
+        }
+        if (cachepath != NULL) {
+            cache_close(&cache);
+        }
+        if (chunking) {
+            cdc_fini(&cdc);
+        }
+        index_free(&pathidx);
+        emit_free(&emit);
+        filter_free(&filter);
+        out_fini(&out);
         break;
     case OMAR_EXTRACT:
         /* Begin extracting the file */
-        if ((error = mkdir(outpath, 0700) != 0)) {
+        if (mkdir(outpath, 0700) != 0 && !(updating && errno == EEXIST)) {
             perror("mkdir");
-            return error;
+            return -errno;
+        }
+
+        if (hotpath != NULL && (retval = hot_load(hotpath)) != 0) {
+            return retval;
         }
 
         retval = archive_extract();
+        map_free(&hotset, false);
+        if (show_stats) {
+            stats_dump();
+        }
         break;
     }
     close(outfd);
@@ -0,0 +1,653 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _OMAR_H_
+#define _OMAR_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* OMAR magic constants */
+#define OMAR_MAGIC "OMAR"
+#define OMAR_EOF "RAMO"
+
+/* Trailer magic constants, see sect.c */
+#define OMAR_SECT "OMSC"
+#define OMAR_TAIL "OMTL"
+
+/* Trailer section types */
+#define OMAR_SECT_INDEX 1
+#define OMAR_SECT_DIRS  2
+#define OMAR_SECT_BLOOM 3
+
+/* OMAR type constants */
+#define OMAR_REG    0
+#define OMAR_DIR    1
+#define OMAR_DEL    2   /* Replaced by 'omar update', skipped */
+#define OMAR_CHUNKED 3  /* Regular file stored as chunks */
+
+#define OMAR_ISFILE(type) ((type) == OMAR_REG || (type) == OMAR_CHUNKED)
+
+/* Revision */
+#define OMAR_REV 2
+
+/*
+ * Revision of entries with parent relative names (see
+ * struct omar_relname), which omar -i writes with
+ * --relative-names. Readers take both.
+ */
+#define OMAR_REV_REL 3
+
+/* Longest full path of an entry with a relative name */
+#define OMAR_PATHMAX 4096
+
+#define ALIGN_UP(value, align)        (((value) + (align)-1) & ~((align)-1))
+#define BLOCK_SIZE 512
+
+/*
+ * The OMAR file header, describes the basics
+ * of a file.
+ *
+ * @magic: Header magic ("OMAR")
+ * @len: Length of the file
+ * @namelen: Length of the filename
+ * @rev: OMAR revision
+ * @mode: File permissions
+ */
+struct omar_hdr {
+    char magic[4];
+    uint8_t type;
+    uint8_t namelen;
+    uint32_t len;
+    uint8_t rev;
+    uint32_t mode;
+} __attribute__((packed));
+
+/*
+ * In an OMAR_REV_REL entry this comes between the header
+ * and the name, which is then only the basename. The
+ * full path is that of the parent plus the basename.
+ *
+ * @parent: Header offset of the parent directory relative
+ *          to the first header, in blocks, OMAR_REL_TOP
+ *          for entries at the top. Parents always come
+ *          before their children.
+ */
+struct omar_relname {
+    uint32_t parent;
+} __attribute__((packed));
+
+#define OMAR_REL_TOP UINT32_MAX
+
+/*
+ * The data of an OMAR_CHUNKED entry starts with this
+ * header, followed by @nchunks chunk descriptors and
+ * then the data of chunks first stored by this entry.
+ *
+ * @size: Length of the file
+ * @nchunks: Number of chunks
+ */
+struct omar_chunkhdr {
+    uint64_t size;
+    uint32_t nchunks;
+} __attribute__((packed));
+
+/*
+ * A chunk of an OMAR_CHUNKED file, in file order.
+ *
+ * @off: Offset of the chunk data relative to the
+ *       first header of the archive
+ * @len: Chunk length
+ */
+struct omar_chunk {
+    uint64_t off;
+    uint32_t len;
+} __attribute__((packed));
+
+/*
+ * A trailer section header
+ *
+ * @magic: Section magic ("OMSC")
+ * @type: Section type (OMAR_SECT_*)
+ * @len: Length of the payload that follows
+ */
+struct omar_sect {
+    char magic[4];
+    uint32_t type;
+    uint64_t len;
+} __attribute__((packed));
+
+/*
+ * Ends the file of an archive with trailer sections
+ *
+ * @magic: Tail magic ("OMTL")
+ * @nsect: Number of sections
+ * @off: Offset of the first section relative to the
+ *       first header of the archive
+ */
+struct omar_tail {
+    char magic[4];
+    uint32_t nsect;
+    uint64_t off;
+} __attribute__((packed));
+
+/*
+ * The index section (OMAR_SECT_INDEX) starts with this
+ * header, followed by @count entries sorted by pathname
+ * and then @namesz bytes of NUL terminated pathnames.
+ */
+struct omar_idxhdr {
+    uint32_t count;
+    uint32_t namesz;
+} __attribute__((packed));
+
+/*
+ * @off: Header offset relative to the first header
+ * @name: Offset of the pathname within the names
+ * @namelen: Length of the pathname
+ */
+struct omar_idxent {
+    uint64_t off;
+    uint32_t name;
+    uint32_t namelen;
+} __attribute__((packed));
+
+/*
+ * The directory section (OMAR_SECT_DIRS) comes with an
+ * index and starts with this header, followed by @ndirs
+ * records and then @nkids entry numbers. Entries are
+ * numbered by their position in the index, the first
+ * record is for the top directory.
+ */
+struct omar_dirhdr {
+    uint32_t ndirs;
+    uint32_t nkids;
+} __attribute__((packed));
+
+/* Entry number of the top directory */
+#define OMAR_DIR_ROOT   UINT32_MAX
+
+/*
+ * A directory with children, records after the first
+ * are sorted by entry number. Directories that are
+ * not listed have no children.
+ *
+ * @ent: Entry number of the directory
+ * @first: Its first child within the entry numbers
+ * @count: Number of children, sorted by name
+ */
+struct omar_dirrec {
+    uint32_t ent;
+    uint32_t first;
+    uint32_t count;
+} __attribute__((packed));
+
+/*
+ * The Bloom filter section (OMAR_SECT_BLOOM) starts with
+ * this header, followed by @nblocks blocks of 512 bits.
+ * A path only ever sets or tests bits of one block, so a
+ * lookup reads a single cache line, see sect.c.
+ *
+ * @nblocks: Number of filter blocks
+ * @nhash: Bits set per path
+ */
+struct omar_bloomhdr {
+    uint32_t nblocks;
+    uint32_t nhash;
+} __attribute__((packed));
+
+#define OMAR_BLOOM_BLOCK    64
+
+/*
+ * An entry as seen by an archive reader.
+ *
+ * @hdr: Copy of the on-disk header
+ * @off: Offset of the header within the archive file
+ * @dataoff: Offset of the file data
+ * @span: Bytes from @off up to the next header (padding included)
+ * @name: NUL terminated pathname
+ */
+struct omar_ent {
+    struct omar_hdr hdr;
+    off_t off;
+    off_t dataoff;
+    off_t span;
+    char name[OMAR_PATHMAX];
+};
+
+/*
+ * An OMAR archive opened for reading. Headers are
+ * served out of a small read window so walking the
+ * archive costs one pread() per window rather than
+ * one per entry.
+ *
+ * @fd: Archive file descriptor
+ * @base: Offset of the first header (past any MBR)
+ * @size: Size of the archive file
+ * @cur: Offset of the next header to be read
+ * @win: Read window
+ * @winoff: Archive offset of @win
+ * @winlen: Number of valid bytes in @win
+ * @rel: The first entry has a parent relative name
+ * @dirs: Directories seen, by block, for relative names
+ */
+struct omar_ar {
+    int fd;
+    off_t base;
+    off_t size;
+    off_t cur;
+    char *win;
+    off_t winoff;
+    size_t winlen;
+    bool rel;
+    struct omar_reldir *dirs;
+    size_t ndirs;
+    size_t dircap;
+};
+
+/*
+ * A directory whose path is known
+ *
+ * @blk: Header offset relative to the first header, in blocks
+ * @name: Full path
+ */
+struct omar_reldir {
+    uint32_t blk;
+    char *name;
+};
+
+/*
+ * Buffered archive output. An output without a file
+ * descriptor only counts bytes (omar --plan).
+ *
+ * @fd: Output file descriptor (-1 if none)
+ * @off: Total number of bytes emitted so far
+ * @buf: Staging buffer
+ * @len: Number of bytes pending in @buf
+ * @drop: Keep the output out of the page cache (--drop-cache),
+ *        for outputs written from the start of the file
+ * @synced: Output offset up to which writeback was started
+ * @dropped: Output offset up to which pages were dropped
+ */
+struct omar_out {
+    int fd;
+    off_t off;
+    char *buf;
+    size_t len;
+    bool drop;
+    off_t synced;
+    off_t dropped;
+};
+
+/* Number of name bytes after a header */
+static inline size_t
+omar_namesz(const struct omar_hdr *hdr)
+{
+    if (hdr->rev == OMAR_REV_REL) {
+        return sizeof(struct omar_relname) + hdr->namelen;
+    }
+
+    return hdr->namelen;
+}
+
+/* Number of bytes an entry occupies, padding included */
+static inline off_t
+omar_span(const struct omar_hdr *hdr)
+{
+    off_t len;
+
+    len = sizeof(*hdr) + omar_namesz(hdr);
+    if (hdr->type != OMAR_DIR) {
+        len += hdr->len;
+    }
+
+    return ALIGN_UP(len, BLOCK_SIZE);
+}
+
+int write_all(int fd, const void *buf, size_t len);
+int pwrite_all(int fd, const void *buf, size_t len, off_t off);
+int pread_all(int fd, void *buf, size_t len, off_t off);
+int read_all(int fd, void *buf, size_t len);
+
+int ar_open(struct omar_ar *ar, const char *path);
+int ar_next(struct omar_ar *ar, struct omar_ent *ent);
+int ar_read(struct omar_ar *ar, off_t off, void *buf, size_t len);
+void ar_rewind(struct omar_ar *ar);
+int ar_size(struct omar_ar *ar, const struct omar_hdr *hdr, off_t dataoff,
+            uint64_t *size);
+int ar_pread(struct omar_ar *ar, const struct omar_hdr *hdr, off_t dataoff,
+             void *buf, size_t len, uint64_t off);
+int ar_copy(struct omar_ar *ar, const struct omar_hdr *hdr, off_t dataoff,
+            uint64_t off, uint64_t len, struct omar_out *out);
+int ar_expand(struct omar_ar *ar, const struct omar_ent *ent,
+              struct omar_out *out);
+void ar_close(struct omar_ar *ar);
+
+int out_init(struct omar_out *out, int fd);
+int out_write(struct omar_out *out, const void *buf, size_t len);
+int out_zero(struct omar_out *out, size_t len);
+int out_copy(struct omar_out *out, int infd, off_t inoff, size_t len);
+int out_stream(struct omar_out *out, int infd, size_t len);
+int out_eof(struct omar_out *out);
+int out_flush(struct omar_out *out);
+void out_fini(struct omar_out *out);
+
+/*
+ * Streaming XXH64 state
+ */
+struct omar_xxh {
+    uint64_t v[4];
+    uint64_t seed;
+    uint64_t total;
+    uint8_t mem[32];
+    size_t memlen;
+};
+
+/*
+ * Streaming SHA-256 state
+ */
+struct omar_sha256 {
+    uint32_t h[8];
+    uint64_t total;
+    uint8_t buf[64];
+    size_t buflen;
+};
+
+void sha256_init(struct omar_sha256 *sha);
+void sha256_update(struct omar_sha256 *sha, const void *buf, size_t len);
+void sha256_final(struct omar_sha256 *sha, uint8_t digest[32]);
+
+void xxh_init(struct omar_xxh *xxh, uint64_t seed);
+void xxh_update(struct omar_xxh *xxh, const void *buf, size_t len);
+uint64_t xxh_final(const struct omar_xxh *xxh);
+uint64_t xxh64(const void *buf, size_t len, uint64_t seed);
+
+/*
+ * A string keyed hash map, used to look up
+ * entries by pathname.
+ */
+struct omar_map {
+    struct omar_mapent *tab;
+    size_t cap;
+    size_t count;
+};
+
+struct omar_mapent {
+    char *key;
+    uint64_t hash;
+    void *val;
+};
+
+uint64_t hash_str(const char *s);
+void **map_get(struct omar_map *map, const char *key);
+void **map_put(struct omar_map *map, const char *key);
+void map_free(struct omar_map *map, bool free_vals);
+
+/*
+ * An index being built
+ *
+ * @dirs: Also write the directory section
+ * @bloom: Also write a Bloom filter of the paths
+ */
+struct omar_index {
+    struct omar_idxent *ents;
+    size_t count;
+    size_t cap;
+    char *names;
+    size_t namesz;
+    size_t namecap;
+    bool dirs;
+    bool bloom;
+};
+
+/*
+ * The directory section of an archive, see sect.c
+ */
+struct omar_dirs {
+    struct omar_dirrec *recs;
+    uint32_t ndirs;
+    uint32_t *kids;
+    uint32_t nkids;
+};
+
+int sect_begin(struct omar_out *out, off_t base);
+int sect_end(struct omar_out *out, off_t base, off_t first, uint32_t nsect);
+int ar_sect(struct omar_ar *ar, uint32_t type, off_t *off, size_t *len);
+
+int index_add(struct omar_index *idx, const char *name, uint64_t off);
+void index_sort(struct omar_index *idx);
+int index_write(struct omar_index *idx, struct omar_out *out);
+int index_load(struct omar_ar *ar, struct omar_index *idx);
+struct omar_idxent *index_find(struct omar_index *idx, const char *name);
+void index_free(struct omar_index *idx);
+int dirs_load(struct omar_ar *ar, const struct omar_index *idx,
+              struct omar_dirs *dirs);
+const uint32_t *dirs_find(const struct omar_dirs *dirs, uint32_t ent,
+                          uint32_t *count);
+void dirs_free(struct omar_dirs *dirs);
+int bloom_check(struct omar_ar *ar, const char *name);
+int out_finish(struct omar_out *out, off_t base, struct omar_index *idx);
+
+/*
+ * Build cache, see cache.c
+ *
+ * @dir: Cache directory
+ * @idxfd: Descriptor of the cache index
+ * @map: Index records by source path
+ * @buf: Copy buffer
+ * @hits: Files served from the cache
+ * @misses: Files read from their source
+ * @saved: Bytes not read from sources thanks to the cache
+ */
+struct omar_cache {
+    const char *dir;
+    int idxfd;
+    struct omar_map map;
+    char *buf;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t saved;
+};
+
+int cache_open(struct omar_cache *cache, const char *dir);
+int cache_get(struct omar_cache *cache, const char *path,
+              const struct stat *sb, size_t head, uint8_t sha[32],
+              uint64_t *xxh);
+int cache_put(struct omar_cache *cache, const char *path,
+              const struct stat *sb, int infd, size_t head,
+              struct omar_out *out, uint8_t sha[32], uint64_t *xxh);
+void cache_close(struct omar_cache *cache);
+
+/*
+ * Content defined chunking state, see cdc.c
+ *
+ * @chunks: Archive offset of each chunk by SHA-256 and length
+ * @base: Output offset of the first header
+ * @nchunks: Chunks pushed
+ * @nunique: Chunks stored
+ * @dedup: Bytes not stored thanks to duplicate chunks
+ * @pad: Block padding after the chunked entries
+ */
+struct omar_cdc {
+    struct omar_map chunks;
+    off_t base;
+    uint64_t nchunks;
+    uint64_t nunique;
+    uint64_t dedup;
+    uint64_t pad;
+};
+
+/* Files smaller than this are never chunked */
+#define CDC_THRESHOLD   (1 << 20)
+
+struct omar_manifest;
+
+void cdc_init(struct omar_cdc *cdc, off_t base);
+int cdc_push(struct omar_cdc *cdc, struct omar_out *out, int infd,
+             const struct stat *sb, const char *name,
+             struct omar_manifest *mf);
+void cdc_fini(struct omar_cdc *cdc);
+
+/*
+ * A path filter rule, see filter.c
+ *
+ * @pat: Pattern, without leading or trailing slash
+ * @include: Rule includes rather than excludes
+ * @dironly: Rule only applies to directories
+ * @fullpath: Pattern matches the whole path
+ * @literal: Pattern has no wildcards
+ */
+struct omar_rule {
+    char *pat;
+    bool include;
+    bool dironly;
+    bool fullpath;
+    bool literal;
+};
+
+struct omar_filter {
+    struct omar_rule *rules;
+    size_t count;
+    size_t cap;
+};
+
+int filter_add(struct omar_filter *filter, const char *pat, bool include);
+bool filter_skip(const struct omar_filter *filter, const char *path, bool isdir);
+void filter_free(struct omar_filter *filter);
+
+/*
+ * A manifest entry, hashed by one worker at a time
+ *
+ * @name: Archive path
+ * @head: Buffers of data waiting to be hashed, in order
+ * @tail: Last buffer waiting
+ * @next: Next entry on the run queue
+ * @busy: On the run queue or being hashed
+ * @ended: All the data was queued
+ * @hashed: @sha and @xxh are final
+ * @sha: SHA-256 of the contents
+ * @xxh: XXH64 of the contents
+ */
+struct omar_mfent {
+    char *name;
+    struct omar_mfblk *head;
+    struct omar_mfblk *tail;
+    struct omar_mfent *next;
+    bool busy;
+    bool ended;
+    bool hashed;
+    struct omar_sha256 shactx;
+    struct omar_xxh xxhctx;
+    uint8_t sha[32];
+    uint64_t xxh;
+};
+
+/*
+ * File digests computed in the background, see manifest.c
+ *
+ * @ents: Entries in archive order
+ * @runq: Entries with data to hash and no worker on them
+ * @free: Buffers ready for reuse
+ * @nblk: Buffers allocated
+ */
+struct omar_manifest {
+    struct omar_mfent **ents;
+    size_t count;
+    size_t cap;
+    struct omar_mfent *runq;
+    struct omar_mfent *runtail;
+    struct omar_mfblk *free;
+    size_t nblk;
+    bool done;
+    pthread_t *td;
+    size_t ntd;
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+    pthread_cond_t room;
+};
+
+int manifest_open(struct omar_manifest *mf);
+int manifest_copy(struct omar_manifest *mf, const char *name,
+                  struct omar_out *out, int fd, uint64_t len);
+int manifest_data(struct omar_manifest *mf, const char *name,
+                  const void *buf, uint64_t len);
+int manifest_put(struct omar_manifest *mf, const char *name,
+                 const uint8_t sha[32], uint64_t xxh);
+int manifest_close(struct omar_manifest *mf, const char *path);
+
+/*
+ * An entry of an image emitted as C, see emit.c
+ *
+ * @name: Archive path
+ * @mode: File mode
+ * @off: Offset of the data within the image file
+ * @size: Length of the data
+ */
+struct omar_emitent {
+    char *name;
+    mode_t mode;
+    off_t off;
+    uint64_t size;
+};
+
+struct omar_emit {
+    struct omar_emitent *ents;
+    size_t count;
+    size_t cap;
+};
+
+int emit_add(struct omar_emit *emit, const char *name, mode_t mode, off_t off,
+             uint64_t size);
+int emit_write(struct omar_emit *emit, const char *base, const char *img);
+void emit_free(struct omar_emit *emit);
+
+/* Copies at least this big are split over threads */
+#define PAR_COPY_MIN    (64 << 20)
+
+size_t par_threads(void);
+void par_for(size_t n, void(*fn)(void *arg, size_t i), void *arg);
+int par_copy(int outfd, off_t outoff, int infd, off_t inoff, size_t len);
+int par_pwrite(int fd, const void *buf, size_t len, off_t off);
+
+int merge_main(int argc, char **argv);
+int diff_main(int argc, char **argv);
+int patch_main(int argc, char **argv);
+int update_main(int argc, char **argv);
+int stitch_main(int argc, char **argv);
+int analyze_main(int argc, char **argv);
+int cmp_main(int argc, char **argv);
+int cat_main(int argc, char **argv);
+int convert_main(int argc, char **argv);
+int ls_main(int argc, char **argv);
+
+#endif  /* !_OMAR_H_ */
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "omar.h"
+
+/* Size of the ranges par_copy() hands out */
+#define PAR_RANGE   (8 << 20)
+
+/* Bounce buffer size when the kernel cannot copy */
+#define PAR_BUFSZ   (1 << 20)
+
+/*
+ * A batch of work handed to par_for()
+ *
+ * @fn: Function run for each index
+ * @arg: Argument passed to @fn
+ * @n: Number of indices
+ * @next: Next index to hand out
+ */
+struct par_job {
+    void(*fn)(void *arg, size_t i);
+    void *arg;
+    size_t n;
+    atomic_size_t next;
+};
+
+static size_t nthreads;
+
+static void *
+par_worker(void *p)
+{
+    struct par_job *job = p;
+    size_t i;
+
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->n) {
+        job->fn(job->arg, i);
+    }
+
+    return NULL;
+}
+
+/*
+ * Number of worker threads to use
+ */
+size_t
+par_threads(void)
+{
+    long ncpu;
+
+    if (nthreads == 0) {
+        ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (ncpu < 1) ? 1 : ncpu;
+    }
+
+    return nthreads;
+}
+
+/*
+ * Run @fn(@arg, i) for every i in [0, @n), spread over
+ * as many threads as there are CPUs. The calling thread
+ * takes part and all work is done once we return.
+ */
+void
+par_for(size_t n, void(*fn)(void *arg, size_t i), void *arg)
+{
+    struct par_job job;
+    pthread_t *td;
+    size_t nt, i;
+
+    job.fn = fn;
+    job.arg = arg;
+    job.n = n;
+    atomic_init(&job.next, 0);
+
+    nt = par_threads();
+    if (nt > n) {
+        nt = n;
+    }
+
+    td = (nt > 1) ? malloc((nt - 1) * sizeof(*td)) : NULL;
+    for (i = 0; td != NULL && i < nt - 1; ++i) {
+        if (pthread_create(&td[i], NULL, par_worker, &job) != 0) {
+            break;
+        }
+    }
+
+    par_worker(&job);
+    while (td != NULL && i-- > 0) {
+        pthread_join(td[i], NULL);
+    }
+
+    free(td);
+}
+
+/*
+ * A copy split into ranges of PAR_RANGE bytes, taken
+ * from @buf if set or else from @infd.
+ */
+struct par_xfer {
+    int outfd;
+    off_t outoff;
+    int infd;
+    off_t inoff;
+    const char *buf;
+    size_t len;
+    atomic_int error;
+};
+
+static void
+par_xfer_range(void *arg, size_t i)
+{
+    struct par_xfer *xfer = arg;
+    size_t len, n;
+    off_t in, out;
+    ssize_t r;
+    char *buf;
+    int error = 0;
+
+    in = xfer->inoff + i * PAR_RANGE;
+    out = xfer->outoff + i * PAR_RANGE;
+    len = xfer->len - i * PAR_RANGE;
+    if (len > PAR_RANGE) {
+        len = PAR_RANGE;
+    }
+
+    if (xfer->buf != NULL) {
+        error = pwrite_all(xfer->outfd, xfer->buf + i * PAR_RANGE, len, out);
+        len = 0;
+    }
+
+    while (len > 0) {
+        r = copy_file_range(xfer->infd, &in, xfer->outfd, &out, len, 0);
+        if (r <= 0) {
+            break;
+        }
+        len -= r;
+    }
+
+    if (len > 0 && (buf = malloc(PAR_BUFSZ)) == NULL) {
+        error = -ENOMEM;
+    } else if (len > 0) {
+        while (len > 0) {
+            n = (len < PAR_BUFSZ) ? len : PAR_BUFSZ;
+            if ((error = pread_all(xfer->infd, buf, n, in)) != 0) {
+                break;
+            }
+            if ((error = pwrite_all(xfer->outfd, buf, n, out)) != 0) {
+                break;
+            }
+            in += n;
+            out += n;
+            len -= n;
+        }
+        free(buf);
+    }
+
+    if (error != 0) {
+        atomic_store(&xfer->error, error);
+    }
+}
+
+/*
+ * Copy @len bytes at @inoff of @infd to @outoff of @outfd
+ * with each thread copying its own ranges. Neither file
+ * offset is used or moved.
+ */
+int
+par_copy(int outfd, off_t outoff, int infd, off_t inoff, size_t len)
+{
+    struct par_xfer xfer = {
+        .outfd = outfd, .outoff = outoff, .infd = infd, .inoff = inoff,
+        .buf = NULL, .len = len
+    };
+
+    atomic_init(&xfer.error, 0);
+    par_for((len + PAR_RANGE - 1) / PAR_RANGE, par_xfer_range, &xfer);
+    return atomic_load(&xfer.error);
+}
+
+/*
+ * Write out an entire buffer at @off of @fd, with
+ * large buffers written by several threads at once.
+ */
+int
+par_pwrite(int fd, const void *buf, size_t len, off_t off)
+{
+    struct par_xfer xfer = {
+        .outfd = fd, .outoff = off, .infd = -1, .inoff = 0,
+        .buf = buf, .len = len
+    };
+
+    atomic_init(&xfer.error, 0);
+    par_for((len + PAR_RANGE - 1) / PAR_RANGE, par_xfer_range, &xfer);
+    return atomic_load(&xfer.error);
+}
@@ -0,0 +1,680 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "omar.h"
+
+/*
+ * Trailer sections
+ *
+ * Extra metadata goes after the EOF record where older
+ * readers never look. The EOF record is padded out to a
+ * block, then each section is a struct omar_sect followed
+ * by its payload padded to a block. The file ends with a
+ * struct omar_tail pointing back at the first section, so
+ * random access readers find the sections with one read.
+ */
+
+/*
+ * Pad out the EOF record, to be called
+ * before the first section is written.
+ */
+int
+sect_begin(struct omar_out *out, off_t base)
+{
+    off_t len;
+
+    len = out->off - base;
+    return out_zero(out, ALIGN_UP(len, BLOCK_SIZE) - len);
+}
+
+/*
+ * Write the tail after the last section
+ *
+ * @first: Output offset of the first section
+ * @nsect: Number of sections written
+ */
+int
+sect_end(struct omar_out *out, off_t base, off_t first, uint32_t nsect)
+{
+    struct omar_tail tail;
+    int error;
+
+    memcpy(tail.magic, OMAR_TAIL, sizeof(tail.magic));
+    tail.nsect = nsect;
+    tail.off = first - base;
+
+    if ((error = out_write(out, &tail, sizeof(tail))) != 0) {
+        return error;
+    }
+
+    return out_flush(out);
+}
+
+/*
+ * Find a trailer section of an archive. On success @off
+ * and @len give where its payload lives in the file.
+ * Returns -ENOENT if the archive does not have one.
+ */
+int
+ar_sect(struct omar_ar *ar, uint32_t type, off_t *off, size_t *len)
+{
+    struct omar_tail tail;
+    struct omar_sect sect;
+    off_t pos;
+    uint32_t i;
+
+    if (ar->size < ar->base + (off_t)sizeof(tail) ||
+        ar_read(ar, ar->size - sizeof(tail), &tail, sizeof(tail)) != 0 ||
+        memcmp(tail.magic, OMAR_TAIL, sizeof(tail.magic)) != 0) {
+        return -ENOENT;
+    }
+
+    pos = ar->base + tail.off;
+    for (i = 0; i < tail.nsect; ++i) {
+        if (ar_read(ar, pos, &sect, sizeof(sect)) != 0 ||
+            memcmp(sect.magic, OMAR_SECT, sizeof(sect.magic)) != 0 ||
+            pos + sizeof(sect) + sect.len > (uint64_t)ar->size) {
+            fprintf(stderr, "omar: bad trailer section\n");
+            return -EINVAL;
+        }
+
+        if (sect.type == type) {
+            *off = pos + sizeof(sect);
+            *len = sect.len;
+            return 0;
+        }
+
+        pos += ALIGN_UP(sizeof(sect) + sect.len, BLOCK_SIZE);
+    }
+
+    return -ENOENT;
+}
+
+/*
+ * Record an entry for the index
+ *
+ * @name: Pathname of the entry
+ * @off: Offset of its header relative to the first header
+ */
+int
+index_add(struct omar_index *idx, const char *name, uint64_t off)
+{
+    struct omar_idxent *ent;
+    size_t len, cap;
+    char *names;
+
+    len = strlen(name);
+    if (idx->count == idx->cap) {
+        cap = (idx->cap == 0) ? 256 : idx->cap * 2;
+        if ((ent = realloc(idx->ents, cap * sizeof(*ent))) == NULL) {
+            return -ENOMEM;
+        }
+        idx->ents = ent;
+        idx->cap = cap;
+    }
+    if (idx->namesz + len + 1 > idx->namecap) {
+        cap = (idx->namecap == 0) ? 4096 : idx->namecap;
+        while (cap < idx->namesz + len + 1) {
+            cap *= 2;
+        }
+        if ((names = realloc(idx->names, cap)) == NULL) {
+            return -ENOMEM;
+        }
+        idx->names = names;
+        idx->namecap = cap;
+    }
+
+    ent = &idx->ents[idx->count++];
+    ent->off = off;
+    ent->name = idx->namesz;
+    ent->namelen = len;
+    memcpy(idx->names + idx->namesz, name, len + 1);
+    idx->namesz += len + 1;
+    return 0;
+}
+
+static const char *sort_names;
+
+static int
+index_cmp(const void *a, const void *b)
+{
+    const struct omar_idxent *ea = a, *eb = b;
+
+    return strcmp(sort_names + ea->name, sort_names + eb->name);
+}
+
+/*
+ * Sort the index by pathname
+ */
+void
+index_sort(struct omar_index *idx)
+{
+    sort_names = idx->names;
+    qsort(idx->ents, idx->count, sizeof(*idx->ents), index_cmp);
+}
+
+/*
+ * Sort the index by pathname and write it out
+ * as a trailer section.
+ */
+int
+index_write(struct omar_index *idx, struct omar_out *out)
+{
+    struct omar_idxhdr ih;
+    struct omar_sect sect;
+    size_t len;
+    int error;
+
+    index_sort(idx);
+
+    ih.count = idx->count;
+    ih.namesz = idx->namesz;
+    len = sizeof(ih) + idx->count * sizeof(*idx->ents) + idx->namesz;
+
+    memcpy(sect.magic, OMAR_SECT, sizeof(sect.magic));
+    sect.type = OMAR_SECT_INDEX;
+    sect.len = len;
+
+    error = out_write(out, &sect, sizeof(sect));
+    if (error == 0) {
+        error = out_write(out, &ih, sizeof(ih));
+    }
+    if (error == 0) {
+        error = out_write(out, idx->ents, idx->count * sizeof(*idx->ents));
+    }
+    if (error == 0) {
+        error = out_write(out, idx->names, idx->namesz);
+    }
+    if (error != 0) {
+        return error;
+    }
+
+    len += sizeof(sect);
+    return out_zero(out, ALIGN_UP(len, BLOCK_SIZE) - len);
+}
+
+/*
+ * Read the index of an archive, returns -ENOENT
+ * if the archive was written without one.
+ */
+int
+index_load(struct omar_ar *ar, struct omar_index *idx)
+{
+    struct omar_idxhdr ih;
+    struct omar_idxent *ent;
+    size_t len, i;
+    off_t off;
+    int error;
+
+    if ((error = ar_sect(ar, OMAR_SECT_INDEX, &off, &len)) != 0) {
+        return error;
+    }
+
+    if (len < sizeof(ih) || (error = ar_read(ar, off, &ih, sizeof(ih))) != 0 ||
+        len != sizeof(ih) + (size_t)ih.count * sizeof(*ent) + ih.namesz) {
+        fprintf(stderr, "omar: bad index\n");
+        return (error != 0) ? error : -EINVAL;
+    }
+
+    memset(idx, 0, sizeof(*idx));
+    idx->ents = malloc(ih.count * sizeof(*ent) + 1);
+    idx->names = malloc(ih.namesz + 1);
+    if (idx->ents == NULL || idx->names == NULL) {
+        fprintf(stderr, "out of memory\n");
+        index_free(idx);
+        return -ENOMEM;
+    }
+
+    idx->count = idx->cap = ih.count;
+    idx->namesz = idx->namecap = ih.namesz;
+    off += sizeof(ih);
+    error = ar_read(ar, off, idx->ents, ih.count * sizeof(*ent));
+    if (error == 0) {
+        error = ar_read(ar, off + ih.count * sizeof(*ent), idx->names,
+                        ih.namesz);
+    }
+
+    for (i = 0; error == 0 && i < idx->count; ++i) {
+        ent = &idx->ents[i];
+        if ((uint64_t)ent->name + ent->namelen >= ih.namesz ||
+            idx->names[ent->name + ent->namelen] != '\0') {
+            fprintf(stderr, "omar: bad index\n");
+            error = -EINVAL;
+        }
+    }
+
+    if (error != 0) {
+        index_free(idx);
+    }
+    return error;
+}
+
+/*
+ * Look up a pathname in a sorted index
+ */
+struct omar_idxent *
+index_find(struct omar_index *idx, const char *name)
+{
+    size_t lo = 0, hi = idx->count, mid;
+    int r;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        r = strcmp(name, idx->names + idx->ents[mid].name);
+        if (r == 0) {
+            return &idx->ents[mid];
+        }
+        if (r < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return NULL;
+}
+
+void
+index_free(struct omar_index *idx)
+{
+    free(idx->ents);
+    free(idx->names);
+    memset(idx, 0, sizeof(*idx));
+}
+
+/*
+ * Write the directory section of a sorted index. The
+ * parent of each entry is found by looking its dirname
+ * up in the index, and since the index is sorted the
+ * children of a directory come out sorted as well.
+ * Entries whose parent is not in the archive are left
+ * out of the section.
+ */
+static int
+dirs_write(struct omar_index *idx, struct omar_out *out)
+{
+    struct omar_dirhdr dh;
+    struct omar_dirrec *recs = NULL;
+    struct omar_idxent *ie;
+    struct omar_sect sect;
+    uint32_t *parent, *cnt, *kids = NULL;
+    uint32_t i, p, n = idx->count;
+    char buf[OMAR_PATHMAX];
+    const char *name, *slash;
+    size_t len;
+    int error = -ENOMEM;
+
+    /* The top directory counts at n */
+    parent = malloc((n + 1) * sizeof(*parent));
+    cnt = calloc(n + 1, sizeof(*cnt));
+    if (parent == NULL || cnt == NULL) {
+        goto done;
+    }
+
+    dh.ndirs = 1;
+    dh.nkids = 0;
+    for (i = 0; i < n; ++i) {
+        name = idx->names + idx->ents[i].name;
+        parent[i] = n;
+        if ((slash = strrchr(name, '/')) != NULL) {
+            snprintf(buf, sizeof(buf), "%.*s", (int)(slash - name), name);
+            ie = index_find(idx, buf);
+            parent[i] = (ie != NULL) ? ie - idx->ents : OMAR_DIR_ROOT;
+        }
+        if (parent[i] == OMAR_DIR_ROOT) {
+            continue;
+        }
+        if (cnt[parent[i]]++ == 0 && parent[i] != n) {
+            ++dh.ndirs;
+        }
+        ++dh.nkids;
+    }
+
+    recs = malloc(dh.ndirs * sizeof(*recs));
+    kids = malloc((dh.nkids + 1) * sizeof(*kids));
+    if (recs == NULL || kids == NULL) {
+        goto done;
+    }
+
+    /* Lay the lists out, cnt becomes the next free slot */
+    recs[0].ent = OMAR_DIR_ROOT;
+    recs[0].first = 0;
+    recs[0].count = cnt[n];
+    cnt[n] = 0;
+    len = recs[0].count;
+    for (i = 0, p = 1; i < n; ++i) {
+        if (cnt[i] == 0) {
+            continue;
+        }
+        recs[p].ent = i;
+        recs[p].first = len;
+        recs[p].count = cnt[i];
+        cnt[i] = len;
+        len += recs[p++].count;
+    }
+    for (i = 0; i < n; ++i) {
+        if (parent[i] != OMAR_DIR_ROOT) {
+            kids[cnt[parent[i]]++] = i;
+        }
+    }
+
+    len = sizeof(dh) + dh.ndirs * sizeof(*recs) + dh.nkids * sizeof(*kids);
+    memcpy(sect.magic, OMAR_SECT, sizeof(sect.magic));
+    sect.type = OMAR_SECT_DIRS;
+    sect.len = len;
+
+    error = out_write(out, &sect, sizeof(sect));
+    if (error == 0) {
+        error = out_write(out, &dh, sizeof(dh));
+    }
+    if (error == 0) {
+        error = out_write(out, recs, dh.ndirs * sizeof(*recs));
+    }
+    if (error == 0) {
+        error = out_write(out, kids, dh.nkids * sizeof(*kids));
+    }
+    if (error == 0) {
+        len += sizeof(sect);
+        error = out_zero(out, ALIGN_UP(len, BLOCK_SIZE) - len);
+    }
+done:
+    if (error == -ENOMEM) {
+        fprintf(stderr, "out of memory\n");
+    }
+    free(parent);
+    free(cnt);
+    free(recs);
+    free(kids);
+    return error;
+}
+
+/*
+ * Read the directory section of an archive, entry numbers
+ * refer to @idx. Returns -ENOENT if there is none.
+ */
+int
+dirs_load(struct omar_ar *ar, const struct omar_index *idx,
+          struct omar_dirs *dirs)
+{
+    struct omar_dirhdr dh;
+    uint32_t i, prev = 0;
+    size_t len;
+    off_t off;
+    int error;
+
+    if ((error = ar_sect(ar, OMAR_SECT_DIRS, &off, &len)) != 0) {
+        return error;
+    }
+
+    if (len < sizeof(dh) || (error = ar_read(ar, off, &dh, sizeof(dh))) != 0 ||
+        dh.ndirs == 0 || len != sizeof(dh) + (size_t)dh.ndirs *
+        sizeof(*dirs->recs) + (size_t)dh.nkids * sizeof(*dirs->kids)) {
+        fprintf(stderr, "omar: bad directory section\n");
+        return (error != 0) ? error : -EINVAL;
+    }
+
+    memset(dirs, 0, sizeof(*dirs));
+    dirs->recs = malloc(dh.ndirs * sizeof(*dirs->recs));
+    dirs->kids = malloc(dh.nkids * sizeof(*dirs->kids) + 1);
+    if (dirs->recs == NULL || dirs->kids == NULL) {
+        fprintf(stderr, "out of memory\n");
+        dirs_free(dirs);
+        return -ENOMEM;
+    }
+
+    dirs->ndirs = dh.ndirs;
+    dirs->nkids = dh.nkids;
+    off += sizeof(dh);
+    error = ar_read(ar, off, dirs->recs, dh.ndirs * sizeof(*dirs->recs));
+    if (error == 0) {
+        error = ar_read(ar, off + dh.ndirs * sizeof(*dirs->recs), dirs->kids,
+                        dh.nkids * sizeof(*dirs->kids));
+    }
+
+    /* Records sorted, lists in range and entries in the index */
+    for (i = 0; error == 0 && i < dirs->ndirs; ++i) {
+        if ((i == 0) != (dirs->recs[i].ent == OMAR_DIR_ROOT) ||
+            (i > 1 && dirs->recs[i].ent <= prev) ||
+            (i > 0 && dirs->recs[i].ent >= idx->count) ||
+            (uint64_t)dirs->recs[i].first + dirs->recs[i].count > dirs->nkids) {
+            error = -EINVAL;
+        }
+        prev = dirs->recs[i].ent;
+    }
+    for (i = 0; error == 0 && i < dirs->nkids; ++i) {
+        if (dirs->kids[i] >= idx->count) {
+            error = -EINVAL;
+        }
+    }
+
+    if (error == -EINVAL) {
+        fprintf(stderr, "omar: bad directory section\n");
+    }
+    if (error != 0) {
+        dirs_free(dirs);
+    }
+    return error;
+}
+
+/*
+ * Get the children of entry @ent (OMAR_DIR_ROOT for the
+ * top directory), NULL with a zero @count if it has none.
+ */
+const uint32_t *
+dirs_find(const struct omar_dirs *dirs, uint32_t ent, uint32_t *count)
+{
+    size_t lo = 1, hi = dirs->ndirs, mid;
+    const struct omar_dirrec *rec = NULL;
+
+    if (ent == OMAR_DIR_ROOT) {
+        rec = &dirs->recs[0];
+    }
+    while (rec == NULL && lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (dirs->recs[mid].ent == ent) {
+            rec = &dirs->recs[mid];
+        } else if (dirs->recs[mid].ent > ent) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    *count = (rec != NULL) ? rec->count : 0;
+    return (*count > 0) ? &dirs->kids[rec->first] : NULL;
+}
+
+void
+dirs_free(struct omar_dirs *dirs)
+{
+    free(dirs->recs);
+    free(dirs->kids);
+    memset(dirs, 0, sizeof(*dirs));
+}
+
+/*
+ * Bloom filter over the paths of an archive. A path picks
+ * one block of 512 bits with the top half of its XXH64 and
+ * BLOOM_NHASH bits within it from 9 bit slices of the hash
+ * times a constant. At 10 bits per path about 1% of absent
+ * paths get through.
+ */
+
+#define BLOOM_NHASH     7
+#define BLOOM_BITS      10
+
+static uint32_t
+bloom_block(uint64_t hash, uint32_t nblocks)
+{
+    return (hash >> 32) % nblocks;
+}
+
+static uint32_t
+bloom_bit(uint64_t hash, uint32_t i)
+{
+    return ((hash * 0x9E3779B97F4A7C15ULL) >> (9 * i)) & 511;
+}
+
+/*
+ * Write the Bloom filter section of an index
+ */
+static int
+bloom_write(struct omar_index *idx, struct omar_out *out)
+{
+    struct omar_bloomhdr bh;
+    struct omar_sect sect;
+    const char *name;
+    uint8_t *bits, *blk;
+    uint64_t hash;
+    size_t i, len;
+    uint32_t j, bit;
+    int error;
+
+    bh.nblocks = (idx->count * BLOOM_BITS + 511) / 512;
+    bh.nblocks = (bh.nblocks == 0) ? 1 : bh.nblocks;
+    bh.nhash = BLOOM_NHASH;
+    if ((bits = calloc(bh.nblocks, OMAR_BLOOM_BLOCK)) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < idx->count; ++i) {
+        name = idx->names + idx->ents[i].name;
+        hash = xxh64(name, idx->ents[i].namelen, 0);
+        blk = bits + (size_t)bloom_block(hash, bh.nblocks) * OMAR_BLOOM_BLOCK;
+        for (j = 0; j < bh.nhash; ++j) {
+            bit = bloom_bit(hash, j);
+            blk[bit / 8] |= 1 << (bit % 8);
+        }
+    }
+
+    len = sizeof(bh) + (size_t)bh.nblocks * OMAR_BLOOM_BLOCK;
+    memcpy(sect.magic, OMAR_SECT, sizeof(sect.magic));
+    sect.type = OMAR_SECT_BLOOM;
+    sect.len = len;
+
+    error = out_write(out, &sect, sizeof(sect));
+    if (error == 0) {
+        error = out_write(out, &bh, sizeof(bh));
+    }
+    if (error == 0) {
+        error = out_write(out, bits, len - sizeof(bh));
+    }
+    if (error == 0) {
+        len += sizeof(sect);
+        error = out_zero(out, ALIGN_UP(len, BLOCK_SIZE) - len);
+    }
+
+    free(bits);
+    return error;
+}
+
+/*
+ * Check an archive's Bloom filter for a pathname, only
+ * the one block of the filter it maps to is read.
+ *
+ * Returns 0 if the archive surely has no such path, 1 if
+ * it may have it and -ENOENT if there is no filter.
+ */
+int
+bloom_check(struct omar_ar *ar, const char *name)
+{
+    struct omar_bloomhdr bh;
+    uint8_t blk[OMAR_BLOOM_BLOCK];
+    uint64_t hash;
+    uint32_t i, bit;
+    size_t len;
+    off_t off;
+    int error;
+
+    if ((error = ar_sect(ar, OMAR_SECT_BLOOM, &off, &len)) != 0) {
+        return error;
+    }
+    if (len < sizeof(bh) || (error = ar_read(ar, off, &bh, sizeof(bh))) != 0 ||
+        bh.nblocks == 0 || bh.nhash == 0 || bh.nhash > BLOOM_NHASH ||
+        len != sizeof(bh) + (size_t)bh.nblocks * OMAR_BLOOM_BLOCK) {
+        fprintf(stderr, "omar: bad Bloom filter\n");
+        return (error != 0) ? error : -EINVAL;
+    }
+
+    hash = xxh64(name, strlen(name), 0);
+    off += sizeof(bh) + (off_t)bloom_block(hash, bh.nblocks) * OMAR_BLOOM_BLOCK;
+    if ((error = ar_read(ar, off, blk, sizeof(blk))) != 0) {
+        return error;
+    }
+
+    for (i = 0; i < bh.nhash; ++i) {
+        bit = bloom_bit(hash, i);
+        if ((blk[bit / 8] & (1 << (bit % 8))) == 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Write the EOF record followed by the index (if any)
+ * and the directory and Bloom filter sections when
+ * asked for
+ *
+ * @base: Output offset of the first header
+ * @idx: Index to write, NULL for none
+ */
+int
+out_finish(struct omar_out *out, off_t base, struct omar_index *idx)
+{
+    off_t first;
+    int error;
+
+    if ((error = out_eof(out)) != 0 || idx == NULL) {
+        return error;
+    }
+
+    if ((error = sect_begin(out, base)) != 0) {
+        return error;
+    }
+
+    first = out->off;
+    if ((error = index_write(idx, out)) != 0) {
+        return error;
+    }
+    if (idx->dirs && (error = dirs_write(idx, out)) != 0) {
+        return error;
+    }
+    if (idx->bloom && (error = bloom_write(idx, out)) != 0) {
+        return error;
+    }
+
+    return sect_end(out, base, first, 1 + idx->dirs + idx->bloom);
+}
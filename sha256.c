@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "omar.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_X86
+#endif
+
+/*
+ * SHA-256 (FIPS 180-4), for manifests meant to be
+ * checked by other tools. Blocks go through the SHA
+ * extensions of the CPU when it has them.
+ */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, r) (((x) >> (r)) | ((x) << (32 - (r))))
+
+static void
+sha256_blocks_sw(uint32_t *state, const uint8_t *p, size_t nblocks)
+{
+    uint32_t w[64], s[8], t1, t2;
+    size_t i;
+
+    while (nblocks-- > 0) {
+        for (i = 0; i < 16; ++i, p += 4) {
+            w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+                   (uint32_t)p[2] << 8 | p[3];
+        }
+        for (i = 16; i < 64; ++i) {
+            w[i] = w[i - 16] + w[i - 7] +
+                   (ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+                   (ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10));
+        }
+
+        memcpy(s, state, sizeof(s));
+        for (i = 0; i < 64; ++i) {
+            t1 = s[7] + (ROTR32(s[4], 6) ^ ROTR32(s[4], 11) ^ ROTR32(s[4], 25)) +
+                 ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256_k[i] + w[i];
+            t2 = (ROTR32(s[0], 2) ^ ROTR32(s[0], 13) ^ ROTR32(s[0], 22)) +
+                 ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+            memmove(&s[1], &s[0], 7 * sizeof(s[0]));
+            s[4] += t1;
+            s[0] = t1 + t2;
+        }
+
+        for (i = 0; i < 8; ++i) {
+            state[i] += s[i];
+        }
+    }
+}
+
+#ifdef SHA256_X86
+__attribute__((target("sha,sse4.1,ssse3")))
+static void
+sha256_blocks_ni(uint32_t *state, const uint8_t *p, size_t nblocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                        0x0405060700010203ULL);
+    __m128i st0, st1, save0, save1, tmp, msg, w[4];
+    size_t i;
+
+    /* The rounds work on ABEF and CDGH */
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    st1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    st0 = _mm_alignr_epi8(tmp, st1, 8);
+    st1 = _mm_blend_epi16(st1, tmp, 0xF0);
+
+    while (nblocks-- > 0) {
+        save0 = st0;
+        save1 = st1;
+
+        for (i = 0; i < 16; ++i) {
+            if (i < 4) {
+                w[i] = _mm_loadu_si128((const __m128i *)(p + i * 16));
+                w[i] = _mm_shuffle_epi8(w[i], mask);
+            } else {
+                tmp = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(i + 3) & 3],
+                                                         w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(tmp, w[(i + 3) & 3]);
+            }
+
+            msg = _mm_add_epi32(w[i & 3],
+                                _mm_loadu_si128((const __m128i *)&sha256_k[i * 4]));
+            st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            st0 = _mm_sha256rnds2_epu32(st0, st1, msg);
+        }
+
+        st0 = _mm_add_epi32(st0, save0);
+        st1 = _mm_add_epi32(st1, save1);
+        p += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(st0, 0x1B);
+    st1 = _mm_shuffle_epi32(st1, 0xB1);
+    st0 = _mm_blend_epi16(tmp, st1, 0xF0);
+    st1 = _mm_alignr_epi8(st1, tmp, 8);
+    _mm_storeu_si128((__m128i *)&state[0], st0);
+    _mm_storeu_si128((__m128i *)&state[4], st1);
+}
+
+static bool
+sha256_has_ni(void)
+{
+    unsigned int a, b, c, d;
+
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1) ||
+        !(c & bit_SSSE3)) {
+        return false;
+    }
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+        return false;
+    }
+
+    return (b & bit_SHA) != 0;
+}
+#endif  /* SHA256_X86 */
+
+static void(*sha256_blocks)(uint32_t *, const uint8_t *, size_t);
+
+void
+sha256_init(struct omar_sha256 *sha)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    /* Benign race, every thread picks the same one */
+    if (sha256_blocks == NULL) {
+#ifdef SHA256_X86
+        sha256_blocks = sha256_has_ni() ? sha256_blocks_ni : sha256_blocks_sw;
+#else
+        sha256_blocks = sha256_blocks_sw;
+#endif
+    }
+
+    memcpy(sha->h, iv, sizeof(iv));
+    sha->total = 0;
+    sha->buflen = 0;
+}
+
+void
+sha256_update(struct omar_sha256 *sha, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    size_t n;
+
+    sha->total += len;
+    if (sha->buflen > 0) {
+        n = sizeof(sha->buf) - sha->buflen;
+        n = (len < n) ? len : n;
+        memcpy(sha->buf + sha->buflen, p, n);
+        sha->buflen += n;
+        p += n;
+        len -= n;
+        if (sha->buflen < sizeof(sha->buf)) {
+            return;
+        }
+        sha256_blocks(sha->h, sha->buf, 1);
+        sha->buflen = 0;
+    }
+
+    if (len >= 64) {
+        sha256_blocks(sha->h, p, len / 64);
+        p += len & ~(size_t)63;
+        len &= 63;
+    }
+
+    memcpy(sha->buf, p, len);
+    sha->buflen = len;
+}
+
+void
+sha256_final(struct omar_sha256 *sha, uint8_t digest[32])
+{
+    uint64_t bits = sha->total * 8;
+    size_t i;
+
+    sha->buf[sha->buflen++] = 0x80;
+    if (sha->buflen > 56) {
+        memset(sha->buf + sha->buflen, 0, 64 - sha->buflen);
+        sha256_blocks(sha->h, sha->buf, 1);
+        sha->buflen = 0;
+    }
+
+    memset(sha->buf + sha->buflen, 0, 56 - sha->buflen);
+    for (i = 0; i < 8; ++i) {
+        sha->buf[63 - i] = bits >> (i * 8);
+    }
+    sha256_blocks(sha->h, sha->buf, 1);
+
+    for (i = 0; i < 8; ++i) {
+        digest[i * 4] = sha->h[i] >> 24;
+        digest[i * 4 + 1] = sha->h[i] >> 16;
+        digest[i * 4 + 2] = sha->h[i] >> 8;
+        digest[i * 4 + 3] = sha->h[i];
+    }
+}
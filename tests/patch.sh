@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Check that patching an archive with diff(old, new) gives
+# back new, byte for byte, with and without an MBR and
+# trailer sections.
+#
+
+set -e
+OMAR=${OMAR:-$(pwd)/bin/omar}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+mkdir -p "$tmp/old/d" "$tmp/new/d" "$tmp/new/e"
+for i in 1 2 3 4; do
+    head -c $((i * 300000)) /dev/urandom > "$tmp/old/d/f$i"
+done
+cp "$tmp/old/d/f1" "$tmp/old/d/f2" "$tmp/old/d/f3" "$tmp/new/d/"
+echo changed >> "$tmp/new/d/f2"
+head -c 70000 /dev/urandom > "$tmp/new/e/g"
+head -c 512 /dev/urandom > "$tmp/mbr"
+
+for flags in "" "--index" "--dirs" "--bloom" "-m $tmp/mbr --dirs --bloom"; do
+    $OMAR $flags -i "$tmp/old" -o "$tmp/old.omar" > /dev/null
+    $OMAR $flags -i "$tmp/new" -o "$tmp/new.omar" > /dev/null
+    $OMAR diff "$tmp/old.omar" "$tmp/new.omar" > "$tmp/d.patch"
+    $OMAR patch -c "$tmp/old.omar" "$tmp/d.patch" > "$tmp/re.omar"
+    if ! cmp "$tmp/re.omar" "$tmp/new.omar"; then
+        echo "patch: round trip failed with [$flags]"
+        exit 1
+    fi
+done
+
+echo "patch: ok"
@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2025 Ian Marco Moffett and the Osmora Team.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Hyra nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+#include <sys/errno.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <libgen.h>
+#include "omar.h"
+
+/*
+ * Where an entry currently lives in the image
+ */
+struct upd_ent {
+    struct omar_hdr hdr;
+    off_t off;
+    off_t span;
+};
+
+/*
+ * A path=source argument, checked and with the source
+ * opened before anything is written.
+ */
+struct upd_arg {
+    const char *name;
+    int srcfd;
+    struct stat sb;
+};
+
+static inline void
+update_help(void)
+{
+    printf("Usage: omar update [archive] [path=source...]\n");
+}
+
+/*
+ * Write the data of @srcfd followed by zero padding up
+ * to @span bytes at @off of the image.
+ */
+static int
+update_data(int fd, off_t off, int srcfd, size_t len, size_t pad)
+{
+    struct omar_out out;
+    int error;
+
+    if (lseek(fd, off, SEEK_SET) < 0) {
+        return -errno;
+    }
+    if ((error = out_init(&out, fd)) != 0) {
+        return error;
+    }
+
+    error = out_copy(&out, srcfd, 0, len);
+    if (error == 0) {
+        error = out_zero(&out, pad);
+    }
+    if (error == 0) {
+        error = out_flush(&out);
+    }
+
+    out_fini(&out);
+    return error;
+}
+
+/*
+ * Append an entry where the EOF record is and put
+ * the EOF record back after it. The data and the new
+ * EOF record go first and the header last, over the
+ * magic of the old EOF record, so an append that fails
+ * leaves the entries of the archive as they were.
+ */
+static int
+update_append(int fd, off_t *eofoff, struct omar_hdr *hdr, const char *name,
+              int srcfd)
+{
+    struct omar_out out;
+    off_t span, dataoff;
+    int error;
+
+    span = omar_span(hdr);
+    dataoff = *eofoff + sizeof(*hdr) + hdr->namelen;
+    if (lseek(fd, dataoff, SEEK_SET) < 0) {
+        return -errno;
+    }
+    if ((error = out_init(&out, fd)) != 0) {
+        return error;
+    }
+
+    error = out_copy(&out, srcfd, 0, hdr->len);
+    if (error == 0) {
+        error = out_zero(&out, span - (sizeof(*hdr) + hdr->namelen + hdr->len));
+    }
+    if (error == 0) {
+        error = out_eof(&out);
+    }
+    out_fini(&out);
+
+    if (error == 0) {
+        error = pwrite_all(fd, name, hdr->namelen, *eofoff + sizeof(*hdr));
+    }
+    if (error == 0) {
+        error = pwrite_all(fd, hdr, sizeof(*hdr), *eofoff);
+    }
+    if (error != 0) {
+        return error;
+    }
+    if (ftruncate(fd, dataoff + out.off) != 0) {
+        return -errno;
+    }
+
+    *eofoff += span;
+    return 0;
+}
+
+/*
+ * Check a single path=source argument against the entries
+ * of the archive and open its source, so a bad argument is
+ * caught before the archive is touched.
+ */
+static int
+update_check(struct omar_map *map, char *arg, struct upd_arg *ua)
+{
+    struct upd_ent *ent = NULL;
+    struct omar_hdr hdr;
+    char parent[OMAR_PATHMAX];
+    char *src;
+    void **slot;
+    size_t len;
+    int error;
+
+    if ((src = strchr(arg, '=')) == NULL) {
+        fprintf(stderr, "omar: %s: expected path=source\n", arg);
+        return -EINVAL;
+    }
+
+    *src++ = '\0';
+    ua->name = arg;
+    len = strlen(arg);
+    if (len == 0 || len >= OMAR_PATHMAX) {
+        fprintf(stderr, "omar: %s: bad path\n", arg);
+        return -EINVAL;
+    }
+
+    if ((slot = map_get(map, arg)) != NULL) {
+        ent = *slot;
+        if (!OMAR_ISFILE(ent->hdr.type)) {
+            fprintf(stderr, "omar: %s: not a regular file\n", arg);
+            return -EISDIR;
+        }
+    } else {
+        /* New files need their parent in the archive */
+        snprintf(parent, sizeof(parent), "%s", arg);
+        dirname(parent);
+        if (strcmp(parent, ".") != 0 && map_get(map, parent) == NULL) {
+            fprintf(stderr, "omar: %s: no parent directory\n", arg);
+            return -ENOENT;
+        }
+    }
+
+    if ((ua->srcfd = open(src, O_RDONLY)) < 0) {
+        error = -errno;
+        perror(src);
+        return error;
+    }
+    if (fstat(ua->srcfd, &ua->sb) != 0 || !S_ISREG(ua->sb.st_mode) ||
+        ua->sb.st_size > UINT32_MAX) {
+        fprintf(stderr, "omar: %s: not a regular file\n", src);
+        close(ua->srcfd);
+        ua->srcfd = -1;
+        return -EINVAL;
+    }
+
+    /* Going to be appended, the full name has to fit */
+    memset(&hdr, 0, sizeof(hdr));
+    if (ent != NULL && ent->hdr.type == OMAR_REG) {
+        hdr = ent->hdr;
+        hdr.len = ua->sb.st_size;
+    }
+    if ((ent == NULL || ent->hdr.type != OMAR_REG ||
+        omar_span(&hdr) > ent->span) && len > UINT8_MAX) {
+        fprintf(stderr, "omar: %s: name too long to append\n", arg);
+        close(ua->srcfd);
+        ua->srcfd = -1;
+        return -ENAMETOOLONG;
+    }
+    return 0;
+}
+
+/*
+ * Replace (or add) a single file checked by update_check().
+ * If the new data still fits in the padded slot of the old
+ * entry it is written over it, otherwise the new entry is
+ * appended and the old one is tombstoned.
+ */
+static int
+update_one(int fd, struct omar_map *map, off_t *eofoff, struct upd_arg *ua)
+{
+    struct upd_ent *ent = NULL;
+    struct omar_hdr hdr, filler;
+    const char *name = ua->name;
+    int srcfd = ua->srcfd;
+    void **slot;
+    int error;
+    off_t span;
+    size_t len;
+
+    len = strlen(name);
+    if ((slot = map_get(map, name)) != NULL) {
+        ent = *slot;
+    }
+
+    /*
+     * Fits in the old slot, rewrite it in place. Chunked
+     * entries may hold chunks of other files, so those are
+     * always replaced. The old name is kept as it is, be
+     * it full or parent relative (rev 3).
+     */
+    memset(&hdr, 0, sizeof(hdr));
+    if (ent != NULL && ent->hdr.type == OMAR_REG) {
+        hdr = ent->hdr;
+        hdr.len = ua->sb.st_size;
+        hdr.mode = ua->sb.st_mode;
+    }
+    if (ent != NULL && ent->hdr.type == OMAR_REG &&
+        (span = omar_span(&hdr)) <= ent->span) {
+        printf("%s [in place]\n", name);
+        error = update_data(fd, ent->off + sizeof(hdr) + omar_namesz(&hdr),
+                            srcfd, hdr.len,
+                            span - (sizeof(hdr) + omar_namesz(&hdr) + hdr.len));
+
+        /*
+         * If the slot shrunk, whatever blocks are left over
+         * become a nameless tombstone so readers still find
+         * the next header.
+         */
+        if (error == 0 && span < ent->span) {
+            memset(&filler, 0, sizeof(filler));
+            memcpy(filler.magic, OMAR_MAGIC, sizeof(filler.magic));
+            filler.type = OMAR_DEL;
+            filler.rev = OMAR_REV;
+            filler.len = ent->span - span - sizeof(filler);
+            if (pwrite(fd, &filler, sizeof(filler), ent->off + span) < 0) {
+                error = -errno;
+            }
+        }
+        if (error == 0 && pwrite(fd, &hdr, sizeof(hdr), ent->off) < 0) {
+            error = -errno;
+        }
+        if (error == 0) {
+            ent->hdr = hdr;
+            ent->span = span;
+        }
+        return error;
+    }
+
+    /* Appended entries always carry their full name */
+    if (len > UINT8_MAX) {
+        fprintf(stderr, "omar: %s: name too long to append\n", name);
+        return -ENAMETOOLONG;
+    }
+    memcpy(hdr.magic, OMAR_MAGIC, sizeof(hdr.magic));
+    hdr.type = OMAR_REG;
+    hdr.namelen = len;
+    hdr.len = ua->sb.st_size;
+    hdr.rev = OMAR_REV;
+    hdr.mode = ua->sb.st_mode;
+
+    printf("%s [appended]\n", name);
+    if ((error = update_append(fd, eofoff, &hdr, name, srcfd)) != 0) {
+        return error;
+    }
+
+    /* The new entry is in place, retire the old one */
+    if (ent != NULL) {
+        ent->hdr.type = OMAR_DEL;
+        if (pwrite(fd, &ent->hdr, sizeof(ent->hdr), ent->off) < 0) {
+            return -errno;
+        }
+    } else {
+        if ((slot = map_put(map, name)) == NULL) {
+            return -ENOMEM;
+        }
+        if ((ent = *slot = malloc(sizeof(*ent))) == NULL) {
+            return -ENOMEM;
+        }
+    }
+
+    ent->hdr = hdr;
+    ent->span = omar_span(&hdr);
+    ent->off = *eofoff - ent->span;
+    return 0;
+}
+
+/*
+ * omar update archive path=source...
+ */
+int
+update_main(int argc, char **argv)
+{
+    struct omar_map map = {0};
+    struct omar_ent ent;
+    struct upd_ent *upd;
+    struct upd_arg *args;
+    struct omar_ar ar;
+    off_t eofoff, endoff, sectoff;
+    size_t sectlen;
+    bool indexed;
+    void **slot;
+    int optc, fd, i, nargs, error;
+
+    while ((optc = getopt(argc, argv, "h")) != -1) {
+        switch (optc) {
+        case 'h':
+            update_help();
+            return 0;
+        default:
+            update_help();
+            return -1;
+        }
+    }
+
+    if (argc - optind < 2) {
+        update_help();
+        return -1;
+    }
+
+    if ((error = ar_open(&ar, argv[optind])) != 0) {
+        return error;
+    }
+
+    while ((error = ar_next(&ar, &ent)) > 0) {
+        if ((slot = map_put(&map, ent.name)) == NULL) {
+            error = -ENOMEM;
+            break;
+        }
+        if (*slot == NULL && (*slot = malloc(sizeof(*upd))) == NULL) {
+            error = -ENOMEM;
+            break;
+        }
+        upd = *slot;
+        upd->hdr = ent.hdr;
+        upd->off = ent.off;
+        upd->span = ent.span;
+    }
+
+    eofoff = endoff = ent.off;
+    indexed = ar_sect(&ar, OMAR_SECT_INDEX, &sectoff, &sectlen) == 0;
+    ar_close(&ar);
+    if (error != 0) {
+        map_free(&map, true);
+        return error;
+    }
+
+    /*
+     * Every argument is checked and its source opened before
+     * the first write, a bad one leaves the archive as it was.
+     */
+    nargs = argc - optind - 1;
+    if ((args = calloc(nargs, sizeof(*args))) == NULL) {
+        map_free(&map, true);
+        return -ENOMEM;
+    }
+    for (i = 0; i < nargs; ++i) {
+        args[i].srcfd = -1;
+    }
+    for (i = 0; i < nargs && error == 0; ++i) {
+        error = update_check(&map, argv[optind + 1 + i], &args[i]);
+    }
+
+    fd = -1;
+    if (error == 0 && (fd = open(argv[optind], O_RDWR)) < 0) {
+        perror(argv[optind]);
+        error = -errno;
+    }
+    for (i = 0; i < nargs && error == 0; ++i) {
+        error = update_one(fd, &map, &eofoff, &args[i]);
+    }
+
+    for (i = 0; i < nargs; ++i) {
+        if (args[i].srcfd >= 0) {
+            close(args[i].srcfd);
+        }
+    }
+    free(args);
+    if (error != 0) {
+        fprintf(stderr, "omar: update failed: %s\n", strerror(-error));
+    }
+
+    /* Appending truncates the trailer sections away */
+    if (indexed && eofoff != endoff) {
+        fprintf(stderr, "omar: %s: index dropped, rebuild with "
+                "'omar merge -I'\n", argv[optind]);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    map_free(&map, true);
+    return error;
+}